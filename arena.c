@@ -0,0 +1,137 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_SLAB_MIN 0x10000 // Size of the first slab.
+#define ARENA_SLAB_MAX 0x400000 // Maximum size of slabs, unless an allocation needs more.
+#define ARENA_KEEP_MAX 0x1000000 // Bytes of slabs kept for reuse after a reset.
+
+#define ARENA_ROUND(size) \
+	(((size) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+struct arena_slab {
+	struct arena_slab *next;
+	size_t size; // Bytes of data.
+	size_t used; // Bytes of data allocated.
+	size_t dirty; // Bytes of data from the beginning that may be nonzero.
+};
+
+#define ARENA_SLAB_DATA(slab) \
+	((unsigned char *)(slab) + ARENA_ROUND(sizeof(struct arena_slab)))
+
+struct hgbf_arena {
+	struct arena_slab *slabs; // Slabs; those after the current one are unused.
+	struct arena_slab *current; // Slab to allocate from; NULL if there are no slabs.
+};
+
+hgbf_arena_t *hgbf_arena_new(void)
+{
+	hgbf_arena_t *const arena = malloc(sizeof *arena);
+	if (!arena)
+		return NULL;
+	arena->slabs = NULL;
+	arena->current = NULL;
+	return arena;
+}
+
+static void arena_free_slabs(struct arena_slab *slab)
+{
+	while (slab) {
+		struct arena_slab *const next = slab->next;
+		free(slab);
+		slab = next;
+	}
+}
+
+void hgbf_arena_free(hgbf_arena_t *arena)
+{
+	if (!arena)
+		return;
+	arena_free_slabs(arena->slabs);
+	free(arena);
+}
+
+// Make the slab after the current one, which has room for `size` bytes, current.
+static struct arena_slab *arena_next_slab(hgbf_arena_t *arena, size_t size)
+{
+	struct arena_slab *const current = arena->current;
+	struct arena_slab *const next = current ? current->next : NULL;
+	if (next && next->size >= size) {
+		next->used = 0;
+		arena->current = next;
+		return next;
+	}
+
+	size_t slab_size = current ? current->size * 2 : ARENA_SLAB_MIN;
+	if (slab_size > ARENA_SLAB_MAX)
+		slab_size = ARENA_SLAB_MAX;
+	if (slab_size < size)
+		slab_size = size;
+	// Large blocks from calloc() are fresh pages, which are zero at no cost.
+	struct arena_slab *const slab =
+		calloc(1, ARENA_ROUND(sizeof(struct arena_slab)) + slab_size);
+	if (!slab)
+		return NULL;
+	slab->next = next;
+	slab->size = slab_size;
+	slab->used = 0;
+	slab->dirty = 0;
+	if (current)
+		current->next = slab;
+	else
+		arena->slabs = slab;
+	arena->current = slab;
+	return slab;
+}
+
+static void *arena_alloc(hgbf_arena_t *arena, size_t size, bool zero)
+{
+	size = ARENA_ROUND(size ? size : 1);
+	struct arena_slab *slab = arena->current;
+	if (!slab || slab->size - slab->used < size) {
+		slab = arena_next_slab(arena, size);
+		if (!slab)
+			return NULL;
+	}
+	unsigned char *const ptr = ARENA_SLAB_DATA(slab) + slab->used;
+	if (zero && slab->used < slab->dirty) {
+		const size_t dirty = slab->dirty - slab->used;
+		memset(ptr, 0, dirty < size ? dirty : size);
+	}
+	slab->used += size;
+	if (slab->dirty < slab->used)
+		slab->dirty = slab->used;
+	return ptr;
+}
+
+void *hgbf_arena_alloc(hgbf_arena_t *arena, size_t size)
+{
+	return arena_alloc(arena, size, false);
+}
+
+void *hgbf_arena_calloc(hgbf_arena_t *arena, size_t size)
+{
+	return arena_alloc(arena, size, true);
+}
+
+void hgbf_arena_reset(hgbf_arena_t *arena)
+{
+	struct arena_slab *slab = arena->slabs;
+	if (!slab)
+		return;
+	slab->used = 0;
+	arena->current = slab;
+	// Keep the first slabs, up to the limit.
+	for (size_t kept = slab->size; slab->next; slab = slab->next) {
+		kept += slab->next->size;
+		if (kept > ARENA_KEEP_MAX) {
+			arena_free_slabs(slab->next);
+			slab->next = NULL;
+			break;
+		}
+	}
+}
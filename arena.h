@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+// Memory arena. Allocations are carved from large slabs and released all at
+// once; the slabs are kept for reuse.
+typedef struct hgbf_arena hgbf_arena_t;
+
+// Create an empty arena.
+hgbf_arena_t *hgbf_arena_new(void);
+
+// Free the arena and all its memory.
+void hgbf_arena_free(hgbf_arena_t *arena);
+
+// Allocate memory aligned for any type. Return NULL if out of memory.
+void *hgbf_arena_alloc(hgbf_arena_t *arena, size_t size);
+
+// Like `hgbf_arena_alloc()`, but the memory is zeroed. Memory not used since
+// it was obtained from the system is known to be zero and is not cleared.
+void *hgbf_arena_calloc(hgbf_arena_t *arena, size_t size);
+
+// Release all allocations.
+void hgbf_arena_reset(hgbf_arena_t *arena);
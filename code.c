@@ -8,8 +8,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined __STDC_NO_THREADS__
+#	include <threads.h>
+#endif // __STDC_NO_THREADS__
+#if defined __unix__
+#	include <unistd.h>
+#endif // __unix__
+
+#include "arena.h"
 #include "error.h"
 #include "opcode.h"
+#include "profile.h"
 #include "stream.h"
 
 #define CODEBUF_CHUNK_SIZE 128
@@ -27,11 +36,13 @@ typedef struct {
 	size_t length;
 	struct codebuf_chunk *last_chunk;
 	struct codebuf_chunk *chunks;
+	hgbf_arena_t *arena; // Memory of the chunks, which are released with it.
 } codebuf_t;
 
 static void _codebuf_add_chunk(codebuf_t *cb)
 {
-	struct codebuf_chunk *const new_chunk = malloc(sizeof(struct codebuf_chunk));
+	struct codebuf_chunk *const new_chunk =
+		hgbf_arena_alloc(cb->arena, sizeof(struct codebuf_chunk));
 	new_chunk->length = 0;
 	new_chunk->next_chunk = NULL;
 
@@ -47,23 +58,15 @@ static void _codebuf_add_chunk(codebuf_t *cb)
 	cb->last_chunk = new_chunk;
 }
 
-static void codebuf_init(codebuf_t *cb)
+static void codebuf_init(codebuf_t *cb, hgbf_arena_t *arena)
 {
 	cb->length = 0;
 	cb->last_chunk = NULL;
 	cb->chunks = NULL;
+	cb->arena = arena;
 	_codebuf_add_chunk(cb);
 }
 
-static void codebuf_destroy(codebuf_t *cb)
-{
-	for (struct codebuf_chunk *chunk = cb->chunks; chunk; ) {
-		struct codebuf_chunk *const next_chunk = chunk->next_chunk;
-		free(chunk);
-		chunk = next_chunk;
-	}
-}
-
 static void codebuf_append1(codebuf_t *cb, unsigned char data)
 {
 	struct codebuf_chunk *current_chunk = cb->last_chunk;
@@ -91,6 +94,25 @@ static void codebuf_append(codebuf_t *cb, const unsigned char *data, size_t size
 	cb->length += size;
 }
 
+// Like `codebuf_append()`, but the data may be split across chunks.
+static void codebuf_append_data(codebuf_t *cb, const unsigned char *data, size_t size)
+{
+	while (size) {
+		struct codebuf_chunk *current_chunk = cb->last_chunk;
+		if (current_chunk->length == sizeof current_chunk->bytes) {
+			_codebuf_add_chunk(cb);
+			current_chunk = cb->last_chunk;
+		}
+		const size_t rest = sizeof current_chunk->bytes - current_chunk->length;
+		const size_t n = size < rest ? size : rest;
+		memcpy(current_chunk->bytes + current_chunk->length, data, n);
+		current_chunk->length += n;
+		cb->length += n;
+		data += n;
+		size -= n;
+	}
+}
+
 static unsigned char *codebuf_ref(codebuf_t *cb, size_t index)
 {
 	assert(index < cb->length);
@@ -135,28 +157,23 @@ static void stack_destroy(stack_t *stack)
 	free(stack->data);
 }
 
-static bool stack_empty(stack_t *stack)
-{
-	return !stack->size;
-}
-
 static size_t stack_top(stack_t *stack)
 {
-	assert(!stack_empty(stack));
+	assert(stack->size);
 	return stack->data[stack->size - 1];
 }
 
 static void stack_push(stack_t *stack, size_t data)
 {
 	assert(stack->size <= stack->capacity);
-	if (stack->size < stack->capacity)
-		stack->data = realloc(stack->data, (stack->capacity *= 2));
+	if (stack->size == stack->capacity)
+		stack->data = realloc(stack->data, sizeof(size_t) * (stack->capacity *= 2));
 	stack->data[stack->size++] = data;
 }
 
 static void stack_pop(stack_t *stack)
 {
-	assert(!stack_empty(stack));
+	assert(stack->size);
 	stack->size--;
 }
 
@@ -257,82 +274,243 @@ static void scanner_drop(scanner_t *scanner)
 	_scanner_advance(scanner);
 }
 
-static bool compile(hgbf_istream_t *source, stack_t *blocks, codebuf_t *code)
+typedef enum {
+	IR_MOVE,   // Move data pointer by `arg` cells.
+	IR_ADD,    // Add `arg` (0 ~ 255) to current cell.
+	IR_OUT,    // Output current cell.
+	IR_IN,     // Input to current cell.
+	IR_LOOP,   // Loop begin, `['. `arg` is the loop number; 0 if not from the script.
+	IR_END,    // Loop end, `]'.
+	IR_LOAD,   // Copy blob `arg` to cells starting from `offset`.
+	IR_PUT,    // Output blob `arg`.
+	IR_ENSURE, // Begin of a region that only accesses cells [`offset`, `arg`].
+	IR_JOIN,   // End of an IR_ENSURE region.
+	IR_ADDV,   // Add blob `arg` (zero-padded) to cells starting from `offset`.
+	IR_SOLVE,  // Run a linear loop in closed form; blob `arg` is the step and SOLVE terms.
+	IR_OUTZ,   // Output cells until a zero one, moving forward, `[.>]'.
+	IR_CAT,    // Copy input to output until a zero byte, `,[.,]'.
+} ir_op_t;
+
+typedef struct {
+	unsigned char op; // ir_op_t
+	bool unchecked; // IR_MOVE: no bounds check is needed.
+	bool cold; // IR_LOOP: the profile shows that the loop is never entered.
+	bool entered; // IR_LOOP: the data is known to be nonzero on entry, so no guard is needed.
+	bool once; // IR_LOOP, IR_END: the data is known to be zero after the body, so it never repeats.
+	bool tiered; // IR_LOOP, IR_END: emitted as TJFZ and TJBN, to be optimized once hot.
+	int32_t offset;
+	int64_t arg;
+} ir_node_t;
+
+typedef struct {
+	size_t size;
+	unsigned char *data;
+} ir_blob_t;
+
+typedef struct {
+	ir_node_t *nodes;
+	size_t length;
+	size_t capacity;
+	ir_blob_t *blobs;
+	size_t blob_count;
+	uint32_t loop_count; // Loops parsed, which are numbered from 1.
+	uint64_t script_hash; // Hash of the nodes parsed, by `ir_hash_parsed()`.
+} ir_t;
+
+static void ir_init(ir_t *ir)
+{
+	const size_t n = 64;
+	ir->nodes = malloc(sizeof(ir_node_t) * n);
+	ir->length = 0;
+	ir->capacity = n;
+	ir->blobs = NULL;
+	ir->blob_count = 0;
+	ir->loop_count = 0;
+	ir->script_hash = UINT64_C(0xcbf29ce484222325);
+}
+
+static void ir_destroy(ir_t *ir)
 {
-	scanner_t scanner;
-	scanner_init(&scanner, source);
+	free(ir->nodes);
+	for (size_t i = 0; i < ir->blob_count; i++)
+		free(ir->blobs[i].data);
+	free(ir->blobs);
+}
+
+// Remove all nodes and blobs. Loops parsed afterwards continue the numbering
+// and the hash.
+static void ir_clear(ir_t *ir)
+{
+	const uint32_t loop_count = ir->loop_count;
+	const uint64_t script_hash = ir->script_hash;
+	ir_destroy(ir);
+	ir_init(ir);
+	ir->loop_count = loop_count;
+	ir->script_hash = script_hash;
+}
+
+// Add the nodes from `begin`, which are just parsed, to the hash of the script.
+static void ir_hash_parsed(ir_t *ir, size_t begin)
+{
+	// FNV-1a
+	uint64_t hash = ir->script_hash;
+	for (size_t i = begin; i < ir->length; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		const uint64_t arg = (uint64_t)node->arg;
+		hash ^= node->op;
+		hash *= UINT64_C(0x100000001b3);
+		for (unsigned int k = 0; k < 64; k += 8) {
+			hash ^= (arg >> k) & 0xff;
+			hash *= UINT64_C(0x100000001b3);
+		}
+	}
+	ir->script_hash = hash;
+}
+
+// Copy data to a new blob and return its index.
+static size_t ir_add_blob(ir_t *ir, const unsigned char *data, size_t size)
+{
+	ir->blobs = realloc(ir->blobs, sizeof(ir_blob_t) * (ir->blob_count + 1));
+	ir_blob_t *const blob = ir->blobs + ir->blob_count;
+	blob->size = size;
+	blob->data = malloc(size);
+	memcpy(blob->data, data, size);
+	return ir->blob_count++;
+}
+
+static ir_node_t *ir_append(ir_t *ir, ir_op_t op, int64_t arg)
+{
+	if (ir->length == ir->capacity)
+		ir->nodes = realloc(ir->nodes, sizeof(ir_node_t) * (ir->capacity *= 2));
+	ir_node_t *const node = ir->nodes + ir->length++;
+	node->op = (unsigned char)op;
+	node->unchecked = false;
+	node->cold = false;
+	node->entered = false;
+	node->once = false;
+	node->tiered = false;
+	node->offset = 0;
+	node->arg = arg;
+	return node;
+}
+
+static ir_node_t *ir_append_node(ir_t *ir, const ir_node_t *node)
+{
+	ir_node_t *const res = ir_append(ir, IR_MOVE, 0);
+	*res = *node;
+	return res;
+}
+
+// Replace IR nodes with the output of a pass. Blobs are kept.
+static void ir_replace(ir_t *ir, ir_t *new_ir)
+{
+	assert(!new_ir->blob_count);
+	free(ir->nodes);
+	ir->nodes = new_ir->nodes;
+	ir->length = new_ir->length;
+	ir->capacity = new_ir->capacity;
+}
+
+// Find the matching IR_END of each IR_LOOP and vice versa. Free the result with `free()`.
+static size_t *ir_match(const ir_t *ir)
+{
+	size_t *const match = malloc(sizeof(size_t) * (ir->length + 1));
+	stack_t loops;
+	stack_init(&loops);
+	for (size_t i = 0; i < ir->length; i++) {
+		const ir_op_t op = (ir_op_t)ir->nodes[i].op;
+		if (op == IR_LOOP) {
+			stack_push(&loops, i);
+		} else if (op == IR_END) {
+			const size_t begin = stack_top(&loops);
+			stack_pop(&loops);
+			match[begin] = i;
+			match[i] = begin;
+		}
+	}
+	assert(!loops.size);
+	stack_destroy(&loops);
+	return match;
+}
+
+// Parse script and append to IR. `depth` is the number of unclosed `['s,
+// which is updated. Unclosed `['s at the end are an error unless `allow_open`.
+// If `segment_min` is not 0, stop once all `['s are closed and the IR has at
+// least `segment_min` nodes.
+static bool parse(scanner_t *scanner, ir_t *ir,
+	size_t *depth_p, bool allow_open, size_t segment_min)
+{
+	size_t depth = *depth_p;
 
 	while (true) {
-		const token_t token = scanner_next(&scanner);
+		if (segment_min && !depth && ir->length >= segment_min) {
+			*depth_p = depth;
+			return true;
+		}
+
+		const token_t token = scanner_next(scanner);
 
 		switch (token) {
 		case TOK_NXT:
 		case TOK_PRV:
-		case TOK_INC:
-		case TOK_DEC:
 		{
-			size_t n = 1;
-			while (scanner_peek(&scanner) == token) {
-				scanner_drop(&scanner);
-				n++;
+			int64_t n = token == TOK_NXT ? 1 : -1;
+			for (token_t t; (t = scanner_peek(scanner)) <= TOK_PRV; ) {
+				scanner_drop(scanner);
+				n += t == TOK_NXT ? 1 : -1;
 			}
+			if (n)
+				ir_append(ir, IR_MOVE, n);
+		}
+			break;
 
-			if (n == 1) {
-				static_assert(
-					(int)HGBF_OP_NXT == (int)TOK_NXT &&
-					(int)HGBF_OP_PRV == (int)TOK_PRV &&
-					(int)HGBF_OP_INC == (int)TOK_INC &&
-					(int)HGBF_OP_DEC == (int)TOK_DEC, "");
-				codebuf_append1(code, (unsigned char)token);
-			} else {
-				static_assert(
-					(int)HGBF_OP_NXTn == (int)TOK_NXT + 9 &&
-					(int)HGBF_OP_PRVn == (int)TOK_PRV + 9 &&
-					(int)HGBF_OP_INCn == (int)TOK_INC + 9 &&
-					(int)HGBF_OP_DECn == (int)TOK_DEC + 9, "");
-				codebuf_append1(code, (unsigned char)((int)token + 9));
-				if (token <= TOK_PRV) {
-					const uint16_t n_ = (uint16_t)n;
-					codebuf_append(code, (const unsigned char *)&n, sizeof n_);
-				} else {
-					const uint8_t n_ = (uint16_t)n;
-					codebuf_append(code, (const unsigned char *)&n, sizeof n_);
-				}
+		case TOK_INC:
+		case TOK_DEC:
+		{
+			unsigned int n = token == TOK_INC ? 1 : 0xff;
+			for (token_t t; (t = scanner_peek(scanner)) == TOK_INC || t == TOK_DEC; ) {
+				scanner_drop(scanner);
+				n += t == TOK_INC ? 1 : 0xff;
 			}
+			if (n & 0xff)
+				ir_append(ir, IR_ADD, n & 0xff);
 		}
 			break;
 
 		case TOK_OUT:
-			codebuf_append1(code, (unsigned char)HGBF_OP_OUT);
+			ir_append(ir, IR_OUT, 0);
 			break;
 
 		case TOK_IN:
-			codebuf_append1(code, (unsigned char)HGBF_OP_IN);
+			ir_append(ir, IR_IN, 0);
 			break;
 
 		case TOK_JFZ:
-			codebuf_append1(code, (unsigned char)HGBF_OP_JFZ);
-			stack_push(blocks, code->length);
-			codebuf_append(code, (const unsigned char *)"\0\0\0", 4);
+			if (depth == HGBF_CODE_DEPTH_MAX) {
+				hgbf_err_record("%zu:%zu: loops are nested deeper than %d",
+					scanner->line_number, scanner->column_number, HGBF_CODE_DEPTH_MAX);
+				return false;
+			}
+			ir_append(ir, IR_LOOP, ++ir->loop_count);
+			depth++;
 			break;
 
 		case TOK_JBN:
-			codebuf_append1(code, (unsigned char)HGBF_OP_JBN);
-			if (stack_empty(blocks)) {
+			if (!depth) {
 				hgbf_err_record("%zu:%zu: no matching `[' for this `]'",
-					scanner.line_number, scanner.column_number);
+					scanner->line_number, scanner->column_number);
 				return false;
-			} else {
-				const size_t pos = stack_top(blocks);
-				stack_pop(blocks);
-				assert(pos < code->length);
-				const uint32_t off = (uint32_t)(code->length - pos);
-				codebuf_append(code, (const unsigned char *)&off, sizeof off);
-				*(uint32_t *)codebuf_ref(code, pos) = off;
 			}
+			ir_append(ir, IR_END, 0);
+			depth--;
 			break;
 
 		case TOK_END:
+			if (depth && !allow_open) {
+				hgbf_err_record("`[' is not closed");
+				return false;
+			}
+			*depth_p = depth;
 			return true;
 
 		default:
@@ -349,31 +527,816 @@ static bool compile(hgbf_istream_t *source, stack_t *blocks, codebuf_t *code)
 	}
 }
 
-hgbf_code_t *hgbf_code_compile(hgbf_istream_t *script)
+typedef struct {
+	bool bounded; // Whether the cells range is statically known.
+	int64_t delta; // Net data pointer movement.
+	int64_t min, max; // Accessed cells relative to the starting position.
+} excursion_t;
+
+// Analyze data pointer movement of nodes in range [begin, end).
+static excursion_t excursion(
+	const ir_t *ir, const size_t *match, size_t begin, size_t end)
 {
-	codebuf_t codebuf;
-	stack_t blocks;
-	codebuf_init(&codebuf);
-	stack_init(&blocks);
-
-	const bool ok = compile(script, &blocks, &codebuf);
-
-	hgbf_code_t *code;
-	if (!ok) {
-		code = NULL;
-	} else if (!stack_empty(&blocks)) {
-		hgbf_err_record("`[' is not closed");
-		code = NULL;
-	} else {
-		codebuf_append1(&codebuf, (unsigned char)HGBF_OP_HLT);
-		code = malloc(sizeof(hgbf_code_t) + codebuf.length);
-		code->length = codebuf.length;
-		codebuf_copy(&codebuf, code->bytes);
+	excursion_t res = {.bounded = true, .delta = 0, .min = 0, .max = 0};
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		if (node->op == IR_MOVE) {
+			res.delta += node->arg;
+			if (res.delta < res.min)
+				res.min = res.delta;
+			else if (res.delta > res.max)
+				res.max = res.delta;
+		} else if (node->op == IR_LOOP) {
+			// A loop is bounded only if each iteration returns to where it starts.
+			const excursion_t body = excursion(ir, match, i + 1, match[i]);
+			if (!body.bounded || body.delta) {
+				res.bounded = false;
+				return res;
+			}
+			if (res.delta + body.min < res.min)
+				res.min = res.delta + body.min;
+			if (res.delta + body.max > res.max)
+				res.max = res.delta + body.max;
+			i = match[i];
+		} else if (node->op == IR_OUTZ) {
+			res.bounded = false;
+			return res;
+		} else if (node->op == IR_LOAD) {
+			const int64_t first = res.delta + node->offset;
+			const int64_t last = first + (int64_t)ir->blobs[node->arg].size - 1;
+			if (first < res.min)
+				res.min = first;
+			if (last > res.max)
+				res.max = last;
+		}
 	}
+	return res;
+}
 
-	codebuf_destroy(&codebuf);
-	stack_destroy(&blocks);
-	return code;
+#define PE_TAPE_SIZE  0x10000
+#define PE_STEPS_MAX  0x100000
+#define PE_OUTPUT_MAX 0x10000
+
+// Append the rest of the program after the node at `pc`. The loops that
+// enclose `pc` are peeled: the remaining part of the current iteration is
+// followed by the whole loop.
+static void _partial_eval_residual(
+	const ir_t *ir, const size_t *match, size_t pc, ir_t *out)
+{
+	stack_t loops;
+	stack_init(&loops);
+	for (size_t i = 0; i < pc; i++) {
+		if (ir->nodes[i].op == IR_LOOP)
+			stack_push(&loops, i);
+		else if (ir->nodes[i].op == IR_END)
+			stack_pop(&loops);
+	}
+
+	size_t begin = pc;
+	while (loops.size) {
+		const size_t loop = stack_top(&loops);
+		stack_pop(&loops);
+		for (size_t i = begin; i < match[loop]; i++)
+			ir_append_node(out, ir->nodes + i);
+		for (size_t i = loop; i <= match[loop]; i++)
+			ir_append_node(out, ir->nodes + i);
+		begin = match[loop] + 1;
+	}
+	for (size_t i = begin; i < ir->length; i++)
+		ir_append_node(out, ir->nodes + i);
+
+	stack_destroy(&loops);
+}
+
+// State of the compile-time interpreter of `partial_eval()`.
+typedef struct {
+	unsigned char *cells; // PE_TAPE_SIZE cells.
+	unsigned char *output; // PE_OUTPUT_MAX bytes.
+	size_t dp, dp_min, dp_max, output_size;
+} pe_t;
+
+static void _partial_eval_reset(pe_t *pe)
+{
+	memset(pe->cells, 0, PE_TAPE_SIZE);
+	pe->dp = PE_TAPE_SIZE / 2;
+	pe->dp_min = SIZE_MAX;
+	pe->dp_max = 0;
+	pe->output_size = 0;
+}
+
+// Interpret at most `steps_max` nodes and return the position of the next one.
+// `*steps_out` is set to the steps done when last at a node out of all loops,
+// and `*off_tape` to whether the data pointer ran off the scratch tape.
+static size_t _partial_eval_run(const ir_t *ir, const size_t *match, pe_t *pe,
+	size_t steps_max, size_t *steps_out, bool *off_tape)
+{
+	unsigned char *const cells = pe->cells;
+	size_t pc = 0, depth = 0, steps = 0;
+	*steps_out = 0;
+	*off_tape = false;
+	for (; pc < ir->length && steps < steps_max; steps++, pc++) {
+		if (!depth)
+			*steps_out = steps;
+		const ir_node_t *const node = ir->nodes + pc;
+		if (node->op == IR_MOVE) {
+			if ((node->arg < 0 && (uint64_t)-node->arg > pe->dp) ||
+					(node->arg > 0 && (uint64_t)node->arg >= PE_TAPE_SIZE - pe->dp)) {
+				*off_tape = true;
+				break;
+			}
+			pe->dp = (size_t)((int64_t)pe->dp + node->arg);
+		} else if (node->op == IR_ADD) {
+			cells[pe->dp] = (unsigned char)(cells[pe->dp] + node->arg);
+			if (pe->dp < pe->dp_min)
+				pe->dp_min = pe->dp;
+			if (pe->dp > pe->dp_max)
+				pe->dp_max = pe->dp;
+		} else if (node->op == IR_OUT) {
+			if (pe->output_size == PE_OUTPUT_MAX)
+				break;
+			pe->output[pe->output_size++] = cells[pe->dp];
+		} else if (node->op == IR_LOOP) {
+			if (!cells[pe->dp])
+				pc = match[pc];
+			else
+				depth++;
+		} else if (node->op == IR_END) {
+			if (cells[pe->dp])
+				pc = match[pc];
+			else
+				depth--;
+		} else {
+			assert(node->op == IR_IN);
+			break;
+		}
+	}
+	return pc;
+}
+
+// Interpret the program at compile time until the first input, or until the
+// steps, cells or output buffer run out. Then replace the executed part with
+// the resulting output, cells and data pointer movement. Unless `continued`,
+// the cells are dropped if the whole program has been executed.
+static void partial_eval(ir_t *ir, bool continued, hgbf_arena_t *arena)
+{
+	size_t *const match = ir_match(ir);
+	pe_t pe = {
+		.cells = hgbf_arena_alloc(arena, PE_TAPE_SIZE),
+		.output = hgbf_arena_alloc(arena, PE_OUTPUT_MAX),
+	};
+	const size_t origin = PE_TAPE_SIZE / 2;
+	_partial_eval_reset(&pe);
+
+	size_t steps;
+	bool off_tape;
+	size_t pc = _partial_eval_run(ir, match, &pe, PE_STEPS_MAX, &steps, &off_tape);
+	if (off_tape) {
+		// The loop that ran off would fill the tape; stop before it instead.
+		bool unused;
+		_partial_eval_reset(&pe);
+		pc = _partial_eval_run(ir, match, &pe, steps, &steps, &unused);
+	}
+
+	if (pc) {
+		ir_t out;
+		ir_init(&out);
+		if (pe.output_size)
+			ir_append(&out, IR_PUT, (int64_t)ir_add_blob(ir, pe.output, pe.output_size));
+		if (pc < ir->length || continued) {
+			const unsigned char *const cells = pe.cells;
+			size_t dp_min = pe.dp_min, dp_max = pe.dp_max;
+			while (dp_min <= dp_max && !cells[dp_min])
+				dp_min++;
+			while (dp_min <= dp_max && !cells[dp_max])
+				dp_max--;
+			if (dp_min <= dp_max) {
+				const size_t blob = ir_add_blob(ir, cells + dp_min, dp_max - dp_min + 1);
+				ir_append(&out, IR_LOAD, (int64_t)blob)->offset =
+					(int32_t)((int64_t)dp_min - (int64_t)origin);
+			}
+			if (pe.dp != origin)
+				ir_append(&out, IR_MOVE, (int64_t)pe.dp - (int64_t)origin);
+		}
+		_partial_eval_residual(ir, match, pc, &out);
+		ir_replace(ir, &out);
+	}
+
+	free(match);
+}
+
+#define KNOWN_WINDOW 64
+#define KNOWN_NONZERO -2
+
+// Known values of the cells around the data pointer. A value is -1 if unknown,
+// or KNOWN_NONZERO if it is only known not to be zero.
+// Cells out of the window are all zero if `rest_zero`, otherwise unknown.
+typedef struct {
+	int16_t cells[KNOWN_WINDOW];
+	bool rest_zero;
+} known_t;
+
+static void known_init(known_t *known, bool zero)
+{
+	for (size_t i = 0; i < KNOWN_WINDOW; i++)
+		known->cells[i] = zero ? 0 : -1;
+	known->rest_zero = zero;
+}
+
+static int known_get(const known_t *known, int64_t offset)
+{
+	const int64_t i = offset + KNOWN_WINDOW / 2;
+	if (i < 0 || i >= KNOWN_WINDOW)
+		return known->rest_zero ? 0 : -1;
+	return known->cells[i];
+}
+
+static void known_set(known_t *known, int64_t offset, int value)
+{
+	const int64_t i = offset + KNOWN_WINDOW / 2;
+	if (i >= 0 && i < KNOWN_WINDOW)
+		known->cells[i] = (int16_t)value;
+	else if (value)
+		known->rest_zero = false;
+}
+
+static void known_move(known_t *known, int64_t n)
+{
+	for (int64_t i = 0; i < KNOWN_WINDOW && known->rest_zero; i++) {
+		if ((i - n < 0 || i - n >= KNOWN_WINDOW) && known->cells[i])
+			known->rest_zero = false;
+	}
+	int16_t cells[KNOWN_WINDOW];
+	for (int64_t i = 0; i < KNOWN_WINDOW; i++) {
+		cells[i] = i + n >= 0 && i + n < KNOWN_WINDOW ?
+			known->cells[i + n] : (known->rest_zero ? 0 : -1);
+	}
+	memcpy(known->cells, cells, sizeof cells);
+}
+
+// Forget the cells that nodes in range [begin, end) may write. The range must
+// not move the data pointer in total, as checked with `excursion()`.
+static void _known_forget_writes(const ir_t *ir, size_t begin, size_t end, known_t *known)
+{
+	int64_t pos = 0;
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		if (node->op == IR_MOVE) {
+			pos += node->arg;
+		} else if (node->op == IR_ADD || node->op == IR_IN) {
+			known_set(known, pos, -1);
+		} else if (node->op == IR_LOAD) {
+			const size_t size = ir->blobs[node->arg].size;
+			for (size_t k = 0; k < size; k++)
+				known_set(known, pos + node->offset + (int64_t)k, -1);
+		}
+	}
+}
+
+// Append an IR_MOVE, merging it into the last node if that is also an IR_MOVE.
+static void ir_append_move(ir_t *ir, int64_t arg)
+{
+	ir_node_t *const last = ir->length ? ir->nodes + ir->length - 1 : NULL;
+	if (!last || last->op != IR_MOVE) {
+		ir_append(ir, IR_MOVE, arg);
+	} else if (!(last->arg += arg)) {
+		ir->length--;
+	}
+}
+
+// Append an IR_ADD, merging it into the last node if that is also an IR_ADD.
+static void ir_append_add(ir_t *ir, int64_t arg)
+{
+	ir_node_t *const last = ir->length ? ir->nodes + ir->length - 1 : NULL;
+	if (!last || last->op != IR_ADD) {
+		ir_append(ir, IR_ADD, arg & 0xff);
+	} else if (!(last->arg = (last->arg + arg) & 0xff)) {
+		ir->length--;
+	}
+}
+
+// Remove the node at `i`, merging the nodes around it if they are both IR_MOVE
+// or both IR_ADD.
+static void ir_remove_node(ir_t *ir, size_t i)
+{
+	memmove(ir->nodes + i, ir->nodes + i + 1, sizeof(ir_node_t) * (ir->length - i - 1));
+	ir->length--;
+	if (!i || i == ir->length)
+		return;
+	ir_node_t *const prev = ir->nodes + i - 1, *const node = ir->nodes + i;
+	if (prev->op != node->op || (node->op != IR_MOVE && node->op != IR_ADD))
+		return;
+	prev->arg += node->arg;
+	if (node->op == IR_ADD)
+		prev->arg &= 0xff;
+	const size_t n = prev->arg ? 1 : 2;
+	memmove(ir->nodes + i + 1 - n, ir->nodes + i + 1, sizeof(ir_node_t) * (ir->length - i - 1));
+	ir->length -= n;
+}
+
+// Whether the loop at `i` is `[-]` or alike, which always ends with a zero cell.
+static bool _is_clear_loop(const ir_t *ir, const size_t *match, size_t i)
+{
+	return match[i] == i + 2 && ir->nodes[i + 1].op == IR_ADD && (ir->nodes[i + 1].arg & 1);
+}
+
+static void _propagate_known_values(const ir_t *ir, const size_t *match,
+	size_t begin, size_t end, known_t *known, ir_t *out)
+{
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+
+		switch ((ir_op_t)node->op) {
+		case IR_MOVE:
+			known_move(known, node->arg);
+			ir_append_move(out, node->arg);
+			break;
+
+		case IR_ADD:
+		{
+			const int value = known_get(known, 0);
+			// Dead store, overwritten by the next input or clear.
+			if (i + 1 < end && (ir->nodes[i + 1].op == IR_IN || (value < 0 &&
+					ir->nodes[i + 1].op == IR_LOOP && _is_clear_loop(ir, match, i + 1))))
+				break;
+			known_set(known, 0, value >= 0 ? (int)((value + node->arg) & 0xff) : -1);
+			ir_append_add(out, node->arg);
+		}
+			break;
+
+		case IR_IN:
+			known_set(known, 0, -1);
+			ir_append_node(out, node);
+			break;
+
+		case IR_LOAD:
+		{
+			const ir_blob_t *const blob = ir->blobs + node->arg;
+			for (size_t k = 0; k < blob->size; k++)
+				known_set(known, node->offset + (int64_t)k, blob->data[k]);
+			ir_append_node(out, node);
+		}
+			break;
+
+		case IR_OUT:
+		case IR_PUT:
+			ir_append_node(out, node);
+			break;
+
+		case IR_LOOP:
+		{
+			const int value = known_get(known, 0);
+			if (!value) {
+				// Dead loop.
+			} else if (_is_clear_loop(ir, match, i)) {
+				if (value > 0)
+					ir_append_add(out, 0x100 - value);
+				else
+					for (size_t k = i; k <= match[i]; k++)
+						ir_append_node(out, ir->nodes + k);
+			} else {
+				// Keep what holds on every iteration: the cells the body does not write.
+				const excursion_t body = excursion(ir, match, i + 1, match[i]);
+				if (body.bounded && !body.delta)
+					_known_forget_writes(ir, i + 1, match[i], known);
+				else
+					known_init(known, false);
+				// The counter is nonzero whenever the body starts.
+				known_t body_known = *known;
+				if (known_get(&body_known, 0) < 0)
+					known_set(&body_known, 0, KNOWN_NONZERO);
+				const size_t head = out->length;
+				ir_append_node(out, node);
+				_propagate_known_values(ir, match, i + 1, match[i], &body_known, out);
+				const bool once = !known_get(&body_known, 0);
+				if (once && value != -1) {
+					// The body runs exactly once.
+					ir_remove_node(out, head);
+					*known = body_known;
+					i = match[i];
+					break;
+				}
+				out->nodes[head].entered = value != -1;
+				out->nodes[head].once = once;
+				ir_append_node(out, ir->nodes + match[i])->once = once;
+			}
+			known_set(known, 0, 0);
+			i = match[i];
+		}
+			break;
+
+		default:
+			abort();
+		}
+	}
+}
+
+// Track known cell values forward, to remove loops that never run, to turn
+// clears of known cells into additions, and to drop additions that are
+// overwritten. Loops entered with a nonzero cell need no guard, loops that end
+// with a zero cell never repeat, and loops with both are replaced with their
+// bodies. If `fresh_tape`, all cells are zero at the beginning.
+static void propagate_known_values(ir_t *ir, bool fresh_tape)
+{
+	size_t *const match = ir_match(ir);
+	known_t known;
+	known_init(&known, fresh_tape);
+	ir_t out;
+	ir_init(&out);
+	_propagate_known_values(ir, match, 0, ir->length, &known, &out);
+	free(match);
+	ir_replace(ir, &out);
+}
+
+#define SOLVE_RANGE_MAX 32
+
+// Cell value as an affine function of the cell values at the start of a loop
+// iteration, modulo 256: `c` plus the sum of `coef[k]` times cell k, where
+// cells are counted from the lowest one the loop accesses.
+typedef struct {
+	unsigned char c;
+	unsigned char coef[SOLVE_RANGE_MAX];
+} affine_t;
+
+// Add `factor` times `src` to `dest`.
+static void affine_add(affine_t *dest, const affine_t *src, unsigned char factor)
+{
+	dest->c = (unsigned char)(dest->c + factor * src->c);
+	for (size_t k = 0; k < SOLVE_RANGE_MAX; k++)
+		dest->coef[k] = (unsigned char)(dest->coef[k] + factor * src->coef[k]);
+}
+
+static bool affine_is_const(const affine_t *a)
+{
+	for (size_t k = 0; k < SOLVE_RANGE_MAX; k++) {
+		if (a->coef[k])
+			return false;
+	}
+	return true;
+}
+
+// Evaluate one iteration of a loop body, nodes in range [begin, end), on the
+// affine cell values, with the counter at index `counter`. Inner loops must
+// only add to cells; they are solved with the trip count, which is affine if
+// the step is odd. Return false if the body is not of that form or an inner
+// loop never ends. The range must be checked with `excursion()` beforehand.
+static bool _solve_eval_body(const ir_t *ir, const size_t *match,
+	size_t begin, size_t end, size_t counter, affine_t *cells)
+{
+	size_t pos = counter;
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		if (node->op == IR_MOVE) {
+			pos = (size_t)((int64_t)pos + node->arg);
+		} else if (node->op == IR_ADD) {
+			cells[pos].c = (unsigned char)(cells[pos].c + node->arg);
+		} else if (node->op == IR_LOOP) {
+			unsigned char deltas[SOLVE_RANGE_MAX] = {0};
+			size_t inner_pos = pos;
+			for (size_t j = i + 1; j < match[i]; j++) {
+				const ir_node_t *const inner = ir->nodes + j;
+				if (inner->op == IR_MOVE)
+					inner_pos = (size_t)((int64_t)inner_pos + inner->arg);
+				else if (inner->op == IR_ADD)
+					deltas[inner_pos] = (unsigned char)(deltas[inner_pos] + inner->arg);
+				else
+					return false;
+			}
+			const unsigned char step = deltas[pos];
+			affine_t trips = {0};
+			if (step & 1) {
+				// -value / step, where the factor is the trip count from 1.
+				affine_add(&trips, cells + pos, (unsigned char)hgbf_trip_count(1, step));
+			} else {
+				const int n = affine_is_const(cells + pos) ? hgbf_trip_count(cells[pos].c, step) : -1;
+				if (n < 0)
+					return false;
+				trips.c = (unsigned char)n;
+			}
+			for (size_t k = 0; k < SOLVE_RANGE_MAX; k++) {
+				if (k != pos && deltas[k])
+					affine_add(cells + k, &trips, deltas[k]);
+			}
+			memset(cells + pos, 0, sizeof *cells);
+			i = match[i];
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void _solve_append_term(unsigned char *terms, size_t *size,
+	int32_t target, int32_t source, unsigned char factor)
+{
+	memcpy(terms + *size, &target, 4);
+	memcpy(terms + *size + 4, &source, 4);
+	terms[*size + 8] = factor;
+	*size += HGBF_SOLVE_TERM_SIZE;
+}
+
+// Check that a loop iteration taking the `count` cells from `start` to `end`
+// has the same effect every time: it adds a constant step to the counter, and
+// to each other cell an amount that depends only on the cells it does not
+// change. Cells whose start values are constant must not change. Append the
+// SOLVE terms to `terms` and return the step, or 0 if the check fails.
+static unsigned char _solve_terms(const affine_t *start, const affine_t *end,
+	size_t counter, size_t count, unsigned char *terms, size_t *terms_size)
+{
+	if (affine_is_const(start + counter) ||
+			memcmp(start[counter].coef, end[counter].coef, sizeof start->coef))
+		return 0;
+	const unsigned char step = (unsigned char)(end[counter].c - start[counter].c);
+	bool invariant[SOLVE_RANGE_MAX];
+	for (size_t k = 0; k < count; k++)
+		invariant[k] = !memcmp(start + k, end + k, sizeof *start);
+
+	for (size_t k = 0; k < count; k++) {
+		if (k == counter || invariant[k])
+			continue;
+		if (affine_is_const(start + k))
+			return 0;
+		affine_t delta = end[k];
+		affine_add(&delta, start + k, 0xff);
+		const int32_t target = (int32_t)k - (int32_t)counter;
+		for (size_t m = 0; m < count; m++) {
+			if (delta.coef[m] && !invariant[m])
+				return 0;
+		}
+		if (delta.c)
+			_solve_append_term(terms, terms_size, target, 0, delta.c);
+		for (size_t m = 0; m < count; m++) {
+			if (delta.coef[m])
+				_solve_append_term(terms, terms_size,
+					target, (int32_t)m - (int32_t)counter, delta.coef[m]);
+		}
+	}
+	return step;
+}
+
+static void _solve_linear_loops(ir_t *ir, const size_t *match,
+	size_t begin, size_t end, ir_t *out);
+
+// Append the loop at `i` solved in closed form to `out`, or return false if
+// it is not a linear loop.
+static bool _solve_loop(ir_t *ir, const size_t *match, size_t i, ir_t *out)
+{
+	const excursion_t range = excursion(ir, match, i + 1, match[i]);
+	if (!range.bounded || range.delta || range.max - range.min >= SOLVE_RANGE_MAX)
+		return false;
+	const size_t count = (size_t)(range.max - range.min + 1);
+	const size_t counter = (size_t)-range.min;
+
+	affine_t start[SOLVE_RANGE_MAX], end[SOLVE_RANGE_MAX];
+	memset(start, 0, sizeof start);
+	for (size_t k = 0; k < count; k++)
+		start[k].coef[k] = 1;
+	memcpy(end, start, sizeof start);
+	if (!_solve_eval_body(ir, match, i + 1, match[i], counter, end))
+		return false;
+
+	unsigned char terms[1 + SOLVE_RANGE_MAX * (SOLVE_RANGE_MAX + 1) * HGBF_SOLVE_TERM_SIZE];
+	size_t terms_size = 1;
+	unsigned char step = _solve_terms(start, end, counter, count, terms, &terms_size);
+	bool peel = false;
+	if (!step) {
+		// Cells that one iteration sets to constants, such as temporaries
+		// cleared by inner loops, start with them on the later iterations.
+		for (size_t k = 0; k < count; k++) {
+			if (affine_is_const(end + k)) {
+				start[k] = end[k];
+				peel = true;
+			}
+		}
+		if (!peel)
+			return false;
+		memcpy(end, start, sizeof start);
+		if (!_solve_eval_body(ir, match, i + 1, match[i], counter, end))
+			return false;
+		terms_size = 1;
+		if (!(step = _solve_terms(start, end, counter, count, terms, &terms_size)))
+			return false;
+	}
+	terms[0] = step;
+
+	const size_t blob = ir_add_blob(ir, terms, terms_size);
+	if (!peel && (step & 1)) {
+		ir_append(out, IR_SOLVE, (int64_t)blob);
+		return true;
+	}
+	// Run the first iteration before solving the rest. If the step is even,
+	// the loop goes on as it is when the counter never reaches zero.
+	const size_t head = out->length;
+	ir_append_node(out, ir->nodes + i);
+	_solve_linear_loops(ir, match, i + 1, match[i], out);
+	ir_append(out, IR_SOLVE, (int64_t)blob);
+	ir_append_node(out, ir->nodes + match[i]);
+	if (step & 1)
+		out->nodes[head].once = out->nodes[out->length - 1].once = true;
+	return true;
+}
+
+static void _solve_linear_loops(ir_t *ir, const size_t *match,
+	size_t begin, size_t end, ir_t *out)
+{
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		if (node->op != IR_LOOP) {
+			ir_append_node(out, node);
+			continue;
+		}
+		if (node->cold || !_solve_loop(ir, match, i, out)) {
+			ir_append_node(out, node);
+			_solve_linear_loops(ir, match, i + 1, match[i], out);
+			ir_append_node(out, ir->nodes + match[i]);
+		}
+		i = match[i];
+	}
+}
+
+// Replace pointer-balanced loops without I/O whose iterations add the same
+// amounts to the cells with IR_SOLVE, which computes the trip count modulo 256
+// and applies all iterations at once. Nested multiplication loops become
+// products of cells. Cold loops are left to run out of line.
+static void solve_linear_loops(ir_t *ir)
+{
+	size_t *const match = ir_match(ir);
+	ir_t out;
+	ir_init(&out);
+	_solve_linear_loops(ir, match, 0, ir->length, &out);
+	free(match);
+	ir_replace(ir, &out);
+}
+
+// Replace the loops of `[.>]' and `,[.,]' with IR_OUTZ and IR_CAT, which
+// output a span of cells or copy the input in bulk.
+static void recognize_bulk_io(ir_t *ir)
+{
+	ir_t out;
+	ir_init(&out);
+	const ir_node_t *const nodes = ir->nodes;
+	for (size_t i = 0; i < ir->length; i++) {
+		const size_t rest = ir->length - i;
+		if (rest >= 4 && nodes[i].op == IR_LOOP && !nodes[i].cold &&
+				nodes[i + 1].op == IR_OUT && nodes[i + 2].op == IR_MOVE &&
+				nodes[i + 2].arg == 1 && nodes[i + 3].op == IR_END) {
+			ir_append(&out, IR_OUTZ, 0);
+			i += 3;
+		} else if (rest >= 5 && nodes[i].op == IR_IN && nodes[i + 1].op == IR_LOOP &&
+				!nodes[i + 1].cold && nodes[i + 2].op == IR_OUT &&
+				nodes[i + 3].op == IR_IN && nodes[i + 4].op == IR_END) {
+			ir_append(&out, IR_CAT, 0);
+			i += 4;
+		} else {
+			ir_append_node(&out, nodes + i);
+		}
+	}
+	ir_replace(ir, &out);
+}
+
+#define ENSURE_RANGE_MAX 256
+#define ENSURE_BLOCK_MIN_MOVES 4
+
+static void _hoist_bounds_checks_region(const ir_t *ir,
+	size_t begin, size_t end, excursion_t range, ir_t *out)
+{
+	ir_node_t *const ensure = ir_append(out, IR_ENSURE, range.max);
+	ensure->offset = (int32_t)range.min;
+	for (size_t i = begin; i < end; i++) {
+		ir_append_node(out, ir->nodes + i);
+		if (ir->nodes[i].op == IR_MOVE)
+			out->nodes[out->length - 1].unchecked = true;
+	}
+	ir_append(out, IR_JOIN, 0);
+}
+
+static void _hoist_bounds_checks(
+	const ir_t *ir, const size_t *match, size_t begin, size_t end, ir_t *out)
+{
+	for (size_t i = begin; i < end; ) {
+		size_t region_end;
+		bool hoist;
+		if (ir->nodes[i].op == IR_LOOP) {
+			region_end = match[i] + 1;
+			hoist = !ir->nodes[i].cold;
+		} else {
+			size_t moves = 0;
+			for (region_end = i; region_end < end; region_end++) {
+				const ir_op_t op = (ir_op_t)ir->nodes[region_end].op;
+				if (op == IR_LOOP)
+					break;
+				if (op == IR_MOVE)
+					moves++;
+			}
+			hoist = moves >= ENSURE_BLOCK_MIN_MOVES;
+		}
+
+		const excursion_t range = excursion(ir, match, i, region_end);
+		if (hoist && range.bounded && range.min < range.max &&
+				range.max - range.min < ENSURE_RANGE_MAX) {
+			_hoist_bounds_checks_region(ir, i, region_end, range, out);
+		} else if (ir->nodes[i].op == IR_LOOP && !ir->nodes[i].cold) {
+			ir_append_node(out, ir->nodes + i);
+			_hoist_bounds_checks(ir, match, i + 1, region_end - 1, out);
+			ir_append_node(out, ir->nodes + region_end - 1);
+		} else {
+			for (size_t j = i; j < region_end; j++)
+				ir_append_node(out, ir->nodes + j);
+		}
+		i = region_end;
+	}
+}
+
+// Wrap loops and straight-line blocks whose cells range is statically known
+// with IR_ENSURE/IR_JOIN, so that the pointer moves inside need no bounds check.
+// Cold loops are left as they are, for they are not worth the duplicated code.
+static void hoist_bounds_checks(ir_t *ir)
+{
+	size_t *const match = ir_match(ir);
+	ir_t out;
+	ir_init(&out);
+	_hoist_bounds_checks(ir, match, 0, ir->length, &out);
+	free(match);
+	ir_replace(ir, &out);
+}
+
+#define ADDV_CELLS_MIN 4
+#define ADDV_SIZE_MAX 256
+
+// Replace the straight-line IR_MOVE/IR_ADD nodes in range [begin, end) with an
+// IR_ADDV and a final IR_MOVE if they update enough cells within a small window.
+static void _vectorize_adds_block(ir_t *ir, size_t begin, size_t end, ir_t *out)
+{
+	int64_t pos = 0, min = 0, max = 0;
+	for (size_t i = begin; i < end; i++) {
+		if (ir->nodes[i].op != IR_MOVE)
+			continue;
+		pos += ir->nodes[i].arg;
+		if (pos < min)
+			min = pos;
+		else if (pos > max)
+			max = pos;
+	}
+
+	if (max - min < ADDV_SIZE_MAX) {
+		unsigned char deltas[ADDV_SIZE_MAX + HGBF_ADDV_CHUNK] = {0};
+		size_t cells = 0, first = SIZE_MAX, last = 0;
+		bool unchecked = true;
+		pos = 0;
+		for (size_t i = begin; i < end; i++) {
+			const ir_node_t *const node = ir->nodes + i;
+			if (node->op == IR_MOVE) {
+				pos += node->arg;
+				unchecked = unchecked && node->unchecked;
+			} else {
+				deltas[pos - min] += (unsigned char)node->arg;
+			}
+		}
+		for (size_t k = 0; k < (size_t)(max - min + 1); k++) {
+			if (!deltas[k])
+				continue;
+			cells++;
+			if (first == SIZE_MAX)
+				first = k;
+			last = k;
+		}
+
+		if (cells >= ADDV_CELLS_MIN) {
+			const size_t size = (last - first + HGBF_ADDV_CHUNK) & ~(size_t)(HGBF_ADDV_CHUNK - 1);
+			ir_node_t *node = ir_append(out, IR_ADDV,
+				(int64_t)ir_add_blob(ir, deltas + first, size));
+			node->offset = (int32_t)(min + (int64_t)first);
+			if (pos) {
+				node = ir_append(out, IR_MOVE, pos);
+				node->unchecked = unchecked;
+			}
+			return;
+		}
+	}
+
+	for (size_t i = begin; i < end; i++)
+		ir_append_node(out, ir->nodes + i);
+}
+
+// Turn straight-line blocks of arithmetic over adjacent cells into IR_ADDV,
+// which is applied to the cells with vector additions.
+static void vectorize_adds(ir_t *ir)
+{
+	ir_t out;
+	ir_init(&out);
+	for (size_t i = 0; i < ir->length; ) {
+		size_t block_end = i;
+		while (block_end < ir->length && (ir->nodes[block_end].op == IR_MOVE ||
+				ir->nodes[block_end].op == IR_ADD))
+			block_end++;
+		if (block_end == i) {
+			ir_append_node(&out, ir->nodes + i);
+			i++;
+		} else {
+			_vectorize_adds_block(ir, i, block_end, &out);
+			i = block_end;
+		}
+	}
+	ir_replace(ir, &out);
 }
 
 static const char *op_name[] = {
@@ -382,45 +1345,879 @@ static const char *op_name[] = {
 #undef HGBF_OPCODE_LIST_ENTRY
 };
 
-static const uint8_t operand_width[] = {
+static const char *op_operands[] = {
 #define HGBF_OPCODE_LIST_ENTRY(NAME, CODE, OPRD) OPRD,
 	HGBF_OPCODE_LIST
 #undef HGBF_OPCODE_LIST_ENTRY
 };
 
+static void emit_op(codebuf_t *code, hgbf_opcode_t op)
+{
+	codebuf_append1(code, (unsigned char)op);
+}
+
+static void emit_u16(codebuf_t *code, uint16_t value)
+{
+	codebuf_append(code, (const unsigned char *)&value, sizeof value);
+}
+
+static void emit_u32(codebuf_t *code, uint32_t value)
+{
+	codebuf_append(code, (const unsigned char *)&value, sizeof value);
+}
+
+static void emit_move(codebuf_t *code, int64_t n, bool unchecked)
+{
+	const bool forward = n > 0;
+	for (uint64_t rest = forward ? (uint64_t)n : -(uint64_t)n; rest; ) {
+		const uint16_t step = rest > UINT16_MAX ? UINT16_MAX : (uint16_t)rest;
+		rest -= step;
+		if (step == 1) {
+			emit_op(code, unchecked ?
+				(forward ? HGBF_OP_UNXT : HGBF_OP_UPRV) :
+				(forward ? HGBF_OP_NXT : HGBF_OP_PRV));
+		} else {
+			emit_op(code, unchecked ?
+				(forward ? HGBF_OP_UNXTn : HGBF_OP_UPRVn) :
+				(forward ? HGBF_OP_NXTn : HGBF_OP_PRVn));
+			emit_u16(code, step);
+		}
+	}
+}
+
+static void emit_add(codebuf_t *code, int64_t n)
+{
+	const unsigned int value = (unsigned int)n & 0xff;
+	if (value == 1) {
+		emit_op(code, HGBF_OP_INC);
+	} else if (value == 0xff) {
+		emit_op(code, HGBF_OP_DEC);
+	} else if (value < 0x80) {
+		emit_op(code, HGBF_OP_INCn);
+		codebuf_append1(code, (unsigned char)value);
+	} else {
+		emit_op(code, HGBF_OP_DECn);
+		codebuf_append1(code, (unsigned char)(0x100 - value));
+	}
+}
+
+// Stacks used during code generation.
+typedef struct {
+	stack_t blocks; // JFZ operand (SIZE_MAX if unguarded) and body positions of unclosed loops.
+	stack_t regions; // IR_ENSURE regions to emit checked versions of.
+	stack_t colds; // Cold loops to emit out of line.
+	stack_t loops; // Position and loop number of each JFZ instruction.
+	size_t hot_count; // Tiered loops so far, which are numbered in order.
+} emit_stacks_t;
+
+// Emit the beginning of a loop, which is guarded by a JFZ unless `entered`,
+// or by a TJFZ if the loop is tiered.
+static void emit_loop(codebuf_t *code, const ir_node_t *node, bool entered, emit_stacks_t *st)
+{
+	size_t guard = SIZE_MAX;
+	if (node->tiered) {
+		emit_op(code, HGBF_OP_TJFZ);
+		emit_u16(code, (uint16_t)st->hot_count++);
+		guard = code->length;
+		emit_u32(code, 0);
+	} else if (!entered) {
+		stack_push(&st->loops, code->length);
+		stack_push(&st->loops, (size_t)node->arg);
+		emit_op(code, HGBF_OP_JFZ);
+		guard = code->length;
+		emit_u32(code, 0);
+	}
+	stack_push(&st->blocks, guard);
+	stack_push(&st->blocks, code->length);
+}
+
+// Emit the end of a loop. The jump back is `op`, which is JBN, TJBN or a
+// JBN-terminated superinstruction, or none if the loop never repeats. A JBN
+// close enough to the loop begin is emitted as JBNs.
+static void emit_end(codebuf_t *code, hgbf_opcode_t op, bool once, stack_t *blocks)
+{
+	const size_t body = stack_top(blocks);
+	stack_pop(blocks);
+	const size_t guard = stack_top(blocks);
+	stack_pop(blocks);
+	if (once) {
+		// No back-edge.
+	} else if (op == HGBF_OP_JBN && code->length + 2 - body <= UINT8_MAX) {
+		emit_op(code, HGBF_OP_JBNs);
+		codebuf_append1(code, (unsigned char)(code->length + 1 - body));
+	} else {
+		emit_op(code, op);
+		if (op == HGBF_OP_TJBN)
+			emit_u16(code, *(uint16_t *)codebuf_ref(code, guard - 2)); // Number from the TJFZ.
+		emit_u32(code, (uint32_t)-(int32_t)(code->length + 4 - body));
+	}
+	if (guard != SIZE_MAX)
+		*(uint32_t *)codebuf_ref(code, guard) = (uint32_t)(code->length - (guard + 4));
+}
+
+// Generate code for nodes in range [begin, end). Frequent node pairs are fused
+// into superinstructions. For each IR_ENSURE region, the IR range, the position
+// of the ENSR jump operand and the position where the region ends are pushed to
+// `regions`, to emit the checked version later. Cold loops are replaced with a
+// JFN, and pushed to `colds` likewise, with whether they are checked.
+static void emit(const ir_t *ir, size_t begin, size_t end, bool checked,
+	emit_stacks_t *st, codebuf_t *code)
+{
+	for (size_t i = begin; i < end; i++) {
+		const ir_node_t *const node = ir->nodes + i;
+		const ir_node_t *const next = i + 1 < end ? node + 1 : NULL;
+
+		switch ((ir_op_t)node->op) {
+		case IR_MOVE:
+		{
+			const bool unchecked = node->unchecked && !checked;
+			if ((node->arg == 1 || node->arg == -1) && next && next->op == IR_END &&
+					!next->once && !next->tiered) {
+				emit_end(code, node->arg > 0 ?
+					(unchecked ? HGBF_OP_UNXTJBN : HGBF_OP_NXTJBN) :
+					(unchecked ? HGBF_OP_UPRVJBN : HGBF_OP_PRVJBN), false, &st->blocks);
+				i++;
+			} else if (node->arg == 1 && next && next->op == IR_ADD && next->arg == 1) {
+				emit_op(code, unchecked ? HGBF_OP_UNXTINC : HGBF_OP_NXTINC);
+				i++;
+			} else {
+				emit_move(code, node->arg, unchecked);
+			}
+		}
+			break;
+
+		case IR_ADD:
+			if (node->arg == 0xff && next && next->op == IR_END &&
+					!next->once && !next->tiered) {
+				emit_end(code, HGBF_OP_DECJBN, false, &st->blocks);
+				i++;
+			} else if (node->arg == 1 && next && next->op == IR_MOVE && next->arg == 1) {
+				emit_op(code, next->unchecked && !checked ?
+					HGBF_OP_INCUNXT : HGBF_OP_INCNXT);
+				i++;
+			} else {
+				emit_add(code, node->arg);
+			}
+			break;
+
+		case IR_OUT:
+			emit_op(code, HGBF_OP_OUT);
+			break;
+
+		case IR_IN:
+			emit_op(code, HGBF_OP_IN);
+			break;
+
+		case IR_OUTZ:
+			emit_op(code, HGBF_OP_OUTZ);
+			break;
+
+		case IR_CAT:
+			emit_op(code, HGBF_OP_CAT);
+			break;
+
+		case IR_LOOP:
+			if (node->cold) {
+				size_t loop_end = i + 1;
+				for (size_t depth = 1; ; loop_end++) {
+					if (ir->nodes[loop_end].op == IR_LOOP)
+						depth++;
+					else if (ir->nodes[loop_end].op == IR_END && !--depth)
+						break;
+				}
+				emit_op(code, HGBF_OP_JFN);
+				stack_push(&st->colds, i);
+				stack_push(&st->colds, code->length);
+				stack_push(&st->colds, loop_end + 1);
+				stack_push(&st->colds, code->length + 4);
+				stack_push(&st->colds, checked);
+				emit_u32(code, 0);
+				i = loop_end;
+				break;
+			}
+			emit_loop(code, node, node->entered, st);
+			break;
+
+		case IR_END:
+			emit_end(code, node->tiered ? HGBF_OP_TJBN : HGBF_OP_JBN, node->once, &st->blocks);
+			break;
+
+		case IR_LOAD:
+		{
+			const ir_blob_t *const blob = ir->blobs + node->arg;
+			for (size_t k = 0; k < blob->size; k += UINT16_MAX) {
+				const size_t size = blob->size - k < UINT16_MAX ? blob->size - k : UINT16_MAX;
+				emit_op(code, HGBF_OP_LOAD);
+				emit_u32(code, (uint32_t)(node->offset + (int64_t)k));
+				emit_u16(code, (uint16_t)size);
+				codebuf_append_data(code, blob->data + k, size);
+			}
+		}
+			break;
+
+		case IR_ADDV:
+		{
+			const ir_blob_t *const blob = ir->blobs + node->arg;
+			emit_op(code, HGBF_OP_ADDV);
+			emit_u32(code, (uint32_t)node->offset);
+			emit_u16(code, (uint16_t)blob->size);
+			codebuf_append_data(code, blob->data, blob->size);
+		}
+			break;
+
+		case IR_SOLVE:
+		{
+			const ir_blob_t *const blob = ir->blobs + node->arg;
+			emit_op(code, HGBF_OP_SOLVE);
+			codebuf_append1(code, blob->data[0]);
+			emit_u16(code, (uint16_t)(blob->size - 1));
+			codebuf_append_data(code, blob->data + 1, blob->size - 1);
+		}
+			break;
+
+		case IR_PUT:
+		{
+			const ir_blob_t *const blob = ir->blobs + node->arg;
+			for (size_t k = 0; k < blob->size; k += UINT16_MAX) {
+				const size_t size = blob->size - k < UINT16_MAX ? blob->size - k : UINT16_MAX;
+				emit_op(code, HGBF_OP_PUT);
+				emit_u16(code, (uint16_t)size);
+				codebuf_append_data(code, blob->data + k, size);
+			}
+		}
+			break;
+
+		case IR_ENSURE:
+			assert(!checked);
+			emit_op(code, HGBF_OP_ENSR);
+			assert(-node->offset <= UINT8_MAX);
+			codebuf_append1(code, (unsigned char)-node->offset);
+			emit_u16(code, (uint16_t)node->arg);
+			stack_push(&st->regions, i + 1);
+			stack_push(&st->regions, code->length);
+			emit_u32(code, 0);
+			break;
+
+		case IR_JOIN:
+			assert(!checked);
+			stack_push(&st->regions, i);
+			stack_push(&st->regions, code->length);
+			break;
+
+		default:
+			abort();
+		}
+	}
+}
+
+// Emit the checked versions of IR_ENSURE regions, which are taken when ENSR
+// fails, and the cold loops, which are taken when JFN jumps.
+static void emit_regions(const ir_t *ir, emit_stacks_t *st, codebuf_t *code)
+{
+	for (size_t k = 0, l = 0; k < st->regions.size || l < st->colds.size; ) {
+		const bool region = k < st->regions.size;
+		size_t begin, skip_pos, end, join_pos;
+		bool checked;
+		if (region) {
+			begin = st->regions.data[k], skip_pos = st->regions.data[k + 1];
+			end = st->regions.data[k + 2], join_pos = st->regions.data[k + 3];
+			checked = true;
+			k += 4;
+		} else {
+			begin = st->colds.data[l], skip_pos = st->colds.data[l + 1];
+			end = st->colds.data[l + 2], join_pos = st->colds.data[l + 3];
+			checked = st->colds.data[l + 4];
+			l += 5;
+		}
+		*(uint32_t *)codebuf_ref(code, skip_pos) =
+			(uint32_t)(code->length - (skip_pos + 4));
+		if (region) {
+			emit(ir, begin, end, true, st, code);
+		} else {
+			// The loop is entered, but keeps its JFZ to count the entries.
+			emit_loop(code, ir->nodes + begin, false, st);
+			emit(ir, begin + 1, end, checked, st, code);
+		}
+		emit_op(code, HGBF_OP_JMP);
+		emit_u32(code, (uint32_t)(int32_t)(join_pos - (code->length + 4)));
+	}
+}
+
+// Decode the packed instruction at `p` into `word`, keeping `j' operands
+// relative. Raw data is stored to `*data` and `*data_size`. Return the end of
+// the instruction, or NULL if the opcode is unknown.
+static const unsigned char *decode_packed(const unsigned char *p,
+	hgbf_word_t *word, const unsigned char **data, size_t *data_size)
+{
+	*word = (hgbf_word_t){.op = *p++};
+	*data = NULL, *data_size = 0;
+	if (word->op >= sizeof op_operands / sizeof op_operands[0])
+		return NULL;
+	size_t operand = 0;
+	for (const char *operands = op_operands[word->op]; *operands; operands++) {
+		switch (*operands) {
+		case 'B': case 'b': operand = word->b = *p; p += 1; break;
+		case 'H': case 'h': operand = word->h = *(const uint16_t *)p; p += 2; break;
+		case 'I': case 'i': case 'j': operand = (uint32_t)(word->i = *(const int32_t *)p); p += 4; break;
+		case '*': *data = p, *data_size = operand; p += operand; break;
+		default: return NULL;
+		}
+	}
+	return p;
+}
+
+// Convert packed code to the aligned layout.
+static hgbf_code_t *relayout_aligned(const hgbf_code_t *code)
+{
+	hgbf_word_t word;
+	const unsigned char *data;
+	size_t data_size;
+
+	// Word index of each instruction, which jumps are converted to.
+	size_t *const index = malloc(sizeof(size_t) * (code->length + 1));
+	size_t count = 0;
+	for (const unsigned char *p = code->bytes, *end = p + code->length; p < end; ) {
+		index[p - code->bytes] = count;
+		p = decode_packed(p, &word, &data, &data_size);
+		assert(p);
+		count += 1 + (data_size + sizeof word - 1) / sizeof word;
+	}
+	index[code->length] = count;
+
+	hgbf_code_t *const res = malloc(sizeof(hgbf_code_t) + sizeof(hgbf_word_t) * count);
+	res->tape_min = code->tape_min;
+	res->tape_max = code->tape_max;
+	res->layout = HGBF_CODE_ALIGNED;
+	res->hot = NULL;
+	res->tier = NULL;
+	res->script_hash = code->script_hash;
+	res->loop_count = code->loop_count;
+	res->loops = malloc(sizeof(hgbf_code_loop_t) * (code->loop_count + 1));
+	for (size_t i = 0; i < code->loop_count; i++) {
+		res->loops[i].position = (uint32_t)index[code->loops[i].position];
+		res->loops[i].number = code->loops[i].number;
+	}
+	res->length = sizeof(hgbf_word_t) * count;
+	hgbf_word_t *w = (hgbf_word_t *)res->bytes;
+	for (const unsigned char *p = code->bytes, *end = p + code->length; p < end; ) {
+		p = decode_packed(p, &word, &data, &data_size);
+		if (word.op == HGBF_OP_JBNs) {
+			// Aligned jumps reach any word.
+			word = (hgbf_word_t){.op = HGBF_OP_JBN,
+				.i = (int32_t)index[(size_t)(p - code->bytes) - word.b]};
+		} else if (strchr(op_operands[word.op], 'j'))
+			word.i = (int32_t)index[(p - code->bytes) + word.i];
+		*w++ = word;
+		if (data_size) {
+			const size_t n = (data_size + sizeof word - 1) / sizeof word;
+			memset(w, 0, sizeof word * n);
+			memcpy(w, data, data_size);
+			w += n;
+		}
+	}
+
+	free(index);
+	return res;
+}
+
+#define PARSE_CHUNK_MIN 0x100000 // Smallest piece of script for a parser thread.
+#define PARSE_THREADS_MAX 64
+
+static size_t parse_threads = 0; // Number of parser threads; 0 for automatic.
+
+typedef struct {
+	const char *begin, *end; // Script piece.
+	ir_t ir;
+	int64_t depth; // Net change of `['s nesting.
+	int64_t depth_min; // Lowest nesting relative to the start, at most 0.
+	int64_t depth_max; // Highest nesting relative to the start, at least 0.
+} parse_chunk_t;
+
+// Append the node of a run of `>'/`<' or `+'/`-' that adds up to `n`, if any,
+// as `parse()` does.
+static void parse_chunk_run(ir_t *ir, char run, int64_t n)
+{
+	if (run == '>' && n)
+		ir_append(ir, IR_MOVE, n);
+	else if (run == '+' && n & 0xff)
+		ir_append(ir, IR_ADD, n & 0xff);
+}
+
+// Parse a piece of script without checking brackets.
+static int parse_chunk(void *arg)
+{
+	parse_chunk_t *const chunk = arg;
+	ir_t *const ir = &chunk->ir;
+	int64_t depth = 0, depth_min = 0, depth_max = 0;
+	char run = 0; // `>' or `+' in a run of `>'/`<' or `+'/`-'.
+	int64_t n = 0;
+	for (const char *p = chunk->begin; p < chunk->end; p++) {
+		const char c = *p;
+		const char kind = c == '<' ? '>' : c == '-' ? '+' : c;
+		if (run && run != kind && c && strchr("><+-.,[]", c)) {
+			parse_chunk_run(ir, run, n);
+			run = 0;
+			n = 0;
+		}
+		switch (c) {
+		case '>': run = '>'; n++; break;
+		case '<': run = '>'; n--; break;
+		case '+': run = '+'; n++; break;
+		case '-': run = '+'; n--; break;
+		case '.': ir_append(ir, IR_OUT, 0); break;
+		case ',': ir_append(ir, IR_IN, 0); break;
+		case '[':
+			ir_append(ir, IR_LOOP, ++ir->loop_count);
+			if (++depth > depth_max)
+				depth_max = depth;
+			break;
+		case ']':
+			ir_append(ir, IR_END, 0);
+			if (--depth < depth_min)
+				depth_min = depth;
+			break;
+		default: break;
+		}
+	}
+	parse_chunk_run(ir, run, n);
+	chunk->depth = depth;
+	chunk->depth_min = depth_min;
+	chunk->depth_max = depth_max;
+	return 0;
+}
+
+// Parse an in-memory script on several threads and append to the IR.
+// Return false without changing the IR if the script is too small to split,
+// threads are unavailable, brackets do not match or loops are nested too
+// deeply; the sequential parser then reports the error.
+static bool parse_parallel(const char *script, size_t size, ir_t *ir)
+{
+	size_t n = parse_threads;
+#if defined __unix__ && defined _SC_NPROCESSORS_ONLN
+	if (!n) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? (size_t)cpus : 1;
+	}
+#endif // __unix__
+	if (n > size / PARSE_CHUNK_MIN)
+		n = size / PARSE_CHUNK_MIN;
+	if (n > PARSE_THREADS_MAX)
+		n = PARSE_THREADS_MAX;
+	if (n < 2)
+		return false;
+
+#if defined __STDC_NO_THREADS__
+	(void)script, (void)ir;
+	return false;
+#else // !__STDC_NO_THREADS__
+	parse_chunk_t chunks[PARSE_THREADS_MAX];
+	thrd_t threads[PARSE_THREADS_MAX];
+	// Split only before `.', `,', `[' or `]' so that no run of `>'/`<' or
+	// `+'/`-' is split between pieces, and the IR is the same as the one of
+	// `parse()`.
+	const char *const end = script + size;
+	const char *begin = script;
+	for (size_t i = 0; i < n; i++) {
+		const char *split = i + 1 < n ? script + size / n * (i + 1) : end;
+		if (split < begin)
+			split = begin;
+		while (split < end && !(*split && strchr(".,[]", *split)))
+			split++;
+		chunks[i].begin = begin;
+		chunks[i].end = split;
+		begin = split;
+		ir_init(&chunks[i].ir);
+	}
+	size_t started = 1;
+	for (; started < n; started++) {
+		if (thrd_create(&threads[started], parse_chunk, &chunks[started]) != thrd_success)
+			break;
+	}
+	parse_chunk(&chunks[0]);
+	for (size_t i = started; i < n; i++)
+		parse_chunk(&chunks[i]);
+	for (size_t i = 1; i < started; i++)
+		thrd_join(threads[i], NULL);
+
+	// Brackets match if nesting never drops below zero and ends at zero.
+	bool ok = true;
+	int64_t depth = 0;
+	size_t length = ir->length;
+	for (size_t i = 0; i < n; i++) {
+		if (depth + chunks[i].depth_min < 0 ||
+				depth + chunks[i].depth_max > HGBF_CODE_DEPTH_MAX)
+			ok = false;
+		depth += chunks[i].depth;
+		length += chunks[i].ir.length;
+	}
+	ok = ok && !depth;
+
+	if (ok) {
+		if (length > ir->capacity) {
+			ir->capacity = length;
+			ir->nodes = realloc(ir->nodes, sizeof(ir_node_t) * length);
+		}
+		for (size_t i = 0; i < n; i++) {
+			const ir_t *const part = &chunks[i].ir;
+			memcpy(ir->nodes + ir->length, part->nodes,
+				sizeof(ir_node_t) * part->length);
+			for (size_t k = ir->length; k < ir->length + part->length; k++) {
+				if (ir->nodes[k].op == IR_LOOP)
+					ir->nodes[k].arg += ir->loop_count;
+			}
+			ir->length += part->length;
+			ir->loop_count += part->loop_count;
+		}
+	}
+	for (size_t i = 0; i < n; i++)
+		ir_destroy(&chunks[i].ir);
+	return ok;
+#endif // __STDC_NO_THREADS__
+}
+
+static hgbf_code_layout_t code_layout = HGBF_CODE_PACKED;
+static bool code_cells_zero_before = true, code_cells_used_after = false;
+static const hgbf_profile_t *code_profile = NULL;
+static hgbf_arena_t *code_arena = NULL; // Scratch memory of `generate()`, kept between calls.
+static uint32_t code_tier_threshold = 0;
+
+// Mark the loops that the profile shows are never entered as cold.
+static void mark_cold_loops(ir_t *ir, const hgbf_profile_t *profile)
+{
+	for (size_t i = 0; i < ir->length; i++) {
+		ir_node_t *const node = ir->nodes + i;
+		if (node->op != IR_LOOP || !node->arg)
+			continue;
+		const hgbf_profile_loop_t *const loop =
+			hgbf_profile_get(profile, (uint32_t)node->arg);
+		node->cold = loop && !loop->entries;
+	}
+}
+
+// Generate code from IR as it is. The cells that the code accesses are in
+// `tape_range` if it is bounded.
+static hgbf_code_t *emit_code(const ir_t *ir, excursion_t tape_range)
+{
+	codebuf_t codebuf;
+	emit_stacks_t st;
+	codebuf_init(&codebuf, code_arena);
+	stack_init(&st.blocks);
+	stack_init(&st.regions);
+	stack_init(&st.colds);
+	stack_init(&st.loops);
+	st.hot_count = 0;
+	emit(ir, 0, ir->length, false, &st, &codebuf);
+	emit_op(&codebuf, HGBF_OP_HLT);
+	emit_regions(ir, &st, &codebuf);
+	assert(!st.blocks.size);
+
+	hgbf_code_t *code = malloc(sizeof(hgbf_code_t) + codebuf.length);
+	code->tape_min = tape_range.bounded ? tape_range.min : 1;
+	code->tape_max = tape_range.bounded ? tape_range.max : 0;
+	code->layout = HGBF_CODE_PACKED;
+	code->loop_count = st.loops.size / 2;
+	code->loops = malloc(sizeof(hgbf_code_loop_t) * (code->loop_count + 1));
+	for (size_t i = 0; i < code->loop_count; i++) {
+		code->loops[i].position = (uint32_t)st.loops.data[i * 2];
+		code->loops[i].number = (uint32_t)st.loops.data[i * 2 + 1];
+	}
+	code->hot = NULL;
+	code->tier = NULL;
+	code->script_hash = ir->script_hash;
+	code->length = codebuf.length;
+	codebuf_copy(&codebuf, code->bytes);
+
+	hgbf_arena_reset(code_arena);
+	stack_destroy(&st.blocks);
+	stack_destroy(&st.regions);
+	stack_destroy(&st.colds);
+	stack_destroy(&st.loops);
+
+	if (code_layout == HGBF_CODE_ALIGNED) {
+		hgbf_code_t *const aligned = relayout_aligned(code);
+		hgbf_code_free(code);
+		code = aligned;
+	}
+	return code;
+}
+
+// Optimize IR and generate code. If `fresh_tape`, the code is assumed to
+// start with all cells being zero. If `continued`, the code is followed by
+// other code that uses the cells.
+static hgbf_code_t *generate(ir_t *ir, bool fresh_tape, bool continued)
+{
+	if (!code_arena)
+		code_arena = hgbf_arena_new();
+	if (code_profile)
+		mark_cold_loops(ir, code_profile);
+	if (fresh_tape)
+		partial_eval(ir, continued, code_arena);
+	propagate_known_values(ir, fresh_tape);
+
+	size_t *const match = ir_match(ir);
+	excursion_t tape_range = excursion(ir, match, 0, ir->length);
+	free(match);
+	if (!fresh_tape)
+		tape_range.bounded = false;
+
+	solve_linear_loops(ir);
+	recognize_bulk_io(ir);
+	hoist_bounds_checks(ir);
+	vectorize_adds(ir);
+
+	return emit_code(ir, tape_range);
+}
+
+struct hgbf_tier {
+	ir_t ir; // Unoptimized script.
+	size_t *match; // See `ir_match()`.
+	size_t *heads; // IR_LOOP position of each tiered loop.
+	size_t count; // Tiered loops.
+};
+
+// Generate tiered code, which runs the script unoptimized until its loops get
+// hot. The IR is moved to the code, to optimize the loops from later.
+static hgbf_code_t *generate_tiered(ir_t *ir, bool fresh_tape)
+{
+	if (!code_arena)
+		code_arena = hgbf_arena_new();
+	hgbf_tier_t *const tier = malloc(sizeof(hgbf_tier_t));
+	tier->ir = *ir;
+	ir_init(ir);
+	ir_t *const tier_ir = &tier->ir;
+	tier->match = ir_match(tier_ir);
+	tier->heads = malloc(sizeof(size_t) * (tier_ir->length / 2 + 1));
+	tier->count = 0;
+	// Loops are numbered with `H' operands; the rest are optimized with their outer loops.
+	for (size_t i = 0; i < tier_ir->length && tier->count <= UINT16_MAX; i++) {
+		if (tier_ir->nodes[i].op == IR_LOOP) {
+			tier_ir->nodes[i].tiered = tier_ir->nodes[tier->match[i]].tiered = true;
+			tier->heads[tier->count++] = i;
+		}
+	}
+
+	excursion_t tape_range = excursion(tier_ir, tier->match, 0, tier_ir->length);
+	if (!fresh_tape)
+		tape_range.bounded = false;
+	hgbf_code_t *const code = emit_code(tier_ir, tape_range);
+	code->hot = malloc(sizeof(hgbf_code_hot_t) * (tier->count + 1));
+	for (size_t i = 0; i < tier->count; i++)
+		code->hot[i] = (hgbf_code_hot_t){.countdown = code_tier_threshold, .kernel = NULL};
+	code->tier = tier;
+	return code;
+}
+
+void hgbf_code_layout(hgbf_code_layout_t layout)
+{
+	code_layout = layout;
+}
+
+void hgbf_code_cells(bool zero_before, bool used_after)
+{
+	code_cells_zero_before = zero_before;
+	code_cells_used_after = used_after;
+}
+
+void hgbf_code_profile(const hgbf_profile_t *profile)
+{
+	code_profile = profile;
+}
+
+void hgbf_code_threads(size_t count)
+{
+	parse_threads = count;
+}
+
+void hgbf_code_tiered(uint32_t threshold)
+{
+	code_tier_threshold = threshold;
+}
+
+hgbf_code_t *hgbf_code_optimize_loop(hgbf_code_t *code, size_t slot)
+{
+	const hgbf_tier_t *const tier = code->tier;
+	assert(slot < tier->count && !code->hot[slot].kernel);
+	const size_t head = tier->heads[slot];
+	ir_t ir;
+	ir_init(&ir);
+	for (size_t i = head; i <= tier->match[head]; i++)
+		ir_append_node(&ir, tier->ir.nodes + i)->tiered = false;
+	hgbf_code_t *const kernel = generate(&ir, false, true);
+	ir_destroy(&ir);
+	code->hot[slot].kernel = kernel;
+	return kernel;
+}
+
+hgbf_code_t *hgbf_code_compile(hgbf_istream_t *script)
+{
+	ir_t ir;
+	ir_init(&ir);
+	size_t source_size;
+	const char *const source = hgbf_istream_mem(script, &source_size);
+	bool ok;
+	if (source && parse_parallel(source, source_size, &ir)) {
+		hgbf_istream_skip(script, source_size);
+		ok = true;
+	} else {
+		scanner_t scanner;
+		scanner_init(&scanner, script);
+		size_t depth = 0;
+		ok = parse(&scanner, &ir, &depth, false, 0);
+	}
+	if (ok) {
+		ir_hash_parsed(&ir, 0);
+		if (code_profile && hgbf_profile_script(code_profile) != ir.script_hash) {
+			hgbf_err_record("the loop profile is of another script");
+			ok = false;
+		}
+	}
+	hgbf_code_t *const code = !ok ? NULL : code_tier_threshold ?
+		generate_tiered(&ir, code_cells_zero_before) :
+		generate(&ir, code_cells_zero_before, code_cells_used_after);
+	ir_destroy(&ir);
+	return code;
+}
+
+#define SEGMENT_MIN_NODES 4096
+
+struct hgbf_compiler {
+	ir_t ir; // Parsed but not yet compiled script.
+	size_t depth; // Unclosed `['s in `ir`.
+	scanner_t scanner; // Scanner for `hgbf_compiler_next()`.
+	size_t segment_count; // Segments generated by `hgbf_compiler_next()`.
+};
+
+hgbf_compiler_t *hgbf_compiler_new(void)
+{
+	hgbf_compiler_t *const compiler = malloc(sizeof(hgbf_compiler_t));
+	ir_init(&compiler->ir);
+	compiler->depth = 0;
+	compiler->scanner.source = NULL;
+	compiler->segment_count = 0;
+	return compiler;
+}
+
+void hgbf_compiler_free(hgbf_compiler_t *compiler)
+{
+	ir_destroy(&compiler->ir);
+	free(compiler);
+}
+
+int hgbf_compiler_feed(hgbf_compiler_t *compiler,
+	hgbf_istream_t *script, hgbf_code_t **code)
+{
+	*code = NULL;
+	scanner_t scanner;
+	scanner_init(&scanner, script);
+	if (!parse(&scanner, &compiler->ir, &compiler->depth, true, 0)) {
+		ir_clear(&compiler->ir);
+		compiler->depth = 0;
+		return -1;
+	}
+	if (compiler->depth)
+		return 0;
+	ir_hash_parsed(&compiler->ir, 0);
+	*code = generate(&compiler->ir, false, true);
+	ir_clear(&compiler->ir);
+	return 0;
+}
+
+int hgbf_compiler_next(hgbf_compiler_t *compiler,
+	hgbf_istream_t *script, hgbf_code_t **code)
+{
+	*code = NULL;
+	if (compiler->scanner.source != script)
+		scanner_init(&compiler->scanner, script);
+	if (scanner_peek(&compiler->scanner) == TOK_END)
+		return 0;
+	const bool ok = parse(&compiler->scanner, &compiler->ir,
+		&compiler->depth, false, SEGMENT_MIN_NODES);
+	if (ok) {
+		ir_hash_parsed(&compiler->ir, 0);
+		*code = generate(&compiler->ir, !compiler->segment_count++,
+			scanner_peek(&compiler->scanner) != TOK_END);
+	}
+	ir_clear(&compiler->ir);
+	compiler->depth = 0;
+	return ok ? 0 : -1;
+}
+
+uint64_t hgbf_code_hash(const hgbf_code_t *code)
+{
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (size_t i = 0; i < code->length; i++) {
+		hash ^= code->bytes[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
 void hgbf_code_dump(const hgbf_code_t *code)
 {
+	const bool aligned = code->layout == HGBF_CODE_ALIGNED;
+
+	// Read an operand of the packed layout at `p`, or from a field of the aligned one.
+#define DUMP_OPERAND(TYPE, FIELD) \
+	(aligned ? (TYPE)word->FIELD : (p += sizeof(TYPE), *(const TYPE *)(p - sizeof(TYPE))))
+
 	for (const unsigned char *p = code->bytes,
 			*const end = p + code->length; p < end; ) {
-		const ptrdiff_t addr = p - code->bytes;
+		const hgbf_word_t *const word = (const hgbf_word_t *)p;
+		const ptrdiff_t addr = aligned ?
+			word - (const hgbf_word_t *)code->bytes : p - code->bytes;
 		const size_t opcode = *p++;
+		if (aligned)
+			p = (const unsigned char *)(word + 1);
 		if (opcode >= sizeof op_name / sizeof op_name[0])
 			goto bad_opcode;
 		const char *const name = op_name[opcode];
-		const size_t oprd_wid = operand_width[opcode];
-		if (!oprd_wid) {
+		const char *operands = op_operands[opcode];
+		if (!*operands) {
 			printf("%04tx: %s\n", addr, name);
 			continue;
 		}
-		unsigned int operand;
-		if (oprd_wid == 1)
-			operand = *(const uint8_t *)p;
-		else if (oprd_wid == 2)
-			operand = *(const uint16_t *)p;
-		else if (oprd_wid == 4)
-			operand = *(const uint32_t *)p;
-		else
-			goto bad_opcode;
-		p += oprd_wid;
-		printf("%04tx: %-6s%u\n", addr, name, operand);
+		printf("%04tx: %-7s ", addr, name);
+		long long operand = 0;
+		for (; *operands; operands++) {
+			switch (*operands) {
+			case 'B': operand = DUMP_OPERAND(uint8_t, b); break;
+			case 'b': operand = DUMP_OPERAND(int8_t, b); break;
+			case 'H': operand = DUMP_OPERAND(uint16_t, h); break;
+			case 'h': operand = DUMP_OPERAND(int16_t, h); break;
+			case 'I': operand = DUMP_OPERAND(uint32_t, i); break;
+			case 'i': case 'j': operand = DUMP_OPERAND(int32_t, i); break;
+			case '*': // Data of previous operand size.
+				p += aligned ? ((size_t)operand + sizeof *word - 1) / sizeof *word * sizeof *word :
+					(size_t)operand;
+				continue;
+			default: goto bad_opcode;
+			}
+			printf(operands[1] && operands[1] != '*' ? "%lld " : "%lld\n", operand);
+		}
 	}
 	return;
 
 bad_opcode:
 	puts("???");
+
+#undef DUMP_OPERAND
 }
 
 void hgbf_code_free(hgbf_code_t *code)
 {
+	hgbf_tier_t *const tier = code->tier;
+	if (tier) {
+		for (size_t i = 0; i < tier->count; i++) {
+			if (code->hot[i].kernel)
+				hgbf_code_free(code->hot[i].kernel);
+		}
+		ir_destroy(&tier->ir);
+		free(tier->match);
+		free(tier->heads);
+		free(tier);
+	}
+	free(code->hot);
+	free(code->loops);
 	free(code);
 }
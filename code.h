@@ -1,19 +1,110 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct _hgbf_istream hgbf_istream_t;
+typedef struct hgbf_profile hgbf_profile_t;
 
-// Code. Last opcode must be HLT.
+// Instruction layouts.
+typedef enum {
+	HGBF_CODE_PACKED, // Variable-length instructions with relative jumps.
+	HGBF_CODE_ALIGNED, // Fixed-size `hgbf_word_t's with absolute jumps.
+} hgbf_code_layout_t;
+
+// The JFZ instruction of a loop.
+typedef struct {
+	uint32_t position; // Byte offset, or word index in the aligned layout.
+	uint32_t number; // Loop number; the n-th `[' in the script is numbered n.
+} hgbf_code_loop_t;
+
+typedef struct hgbf_tier hgbf_tier_t;
+
+// A loop of tiered code, numbered by its TJFZ and TJBN instructions. Loops are
+// updated by evaluation, and their kernels are owned and freed with the code.
+typedef struct {
+	uint32_t countdown; // Back-edges left until the loop is optimized.
+	struct hgbf_code *kernel; // Optimized code of the loop, or NULL.
+} hgbf_code_hot_t;
+
+// Code. Execution ends at a HLT instruction.
 typedef struct hgbf_code {
+	int64_t tape_min, tape_max; // Statically known cells range; empty if unbounded.
+	hgbf_code_layout_t layout;
+	size_t loop_count;
+	hgbf_code_loop_t *loops; // JFZ instructions of loops; loops known to be entered have none.
+	hgbf_code_hot_t *hot; // Loops of tiered code, or NULL if not tiered.
+	hgbf_tier_t *tier; // Script to optimize the loops of tiered code from.
+	uint64_t script_hash; // Hash of the script up to the end of the code, to tie profiles to.
 	size_t length;
 	unsigned char bytes[];
 } hgbf_code_t;
 
+// Set the instruction layout of code generated afterwards. Default is packed.
+void hgbf_code_layout(hgbf_code_layout_t layout);
+
+// Set whether code compiled afterwards by `hgbf_code_compile()` may assume all
+// cells to be zero at the start, and whether the cells are used after the end.
+// Default is zero before and unused after.
+void hgbf_code_cells(bool zero_before, bool used_after);
+
+// Set the number of threads to parse large in-memory scripts with.
+// 0 means the number of processors, which is the default.
+void hgbf_code_threads(size_t count);
+
+// Set the profile to optimize code generated afterwards for, or NULL for none.
+// Loops that were never entered are moved out of line and left unoptimized.
+// `hgbf_code_compile()` fails if the profile was recorded from another script.
+void hgbf_code_profile(const hgbf_profile_t *profile);
+
+// Set the back-edges after which a loop of code compiled afterwards by
+// `hgbf_code_compile()` is optimized, or 0 to optimize the whole script at
+// compile time, which is the default. Code generated with a threshold is tiered:
+// it runs unoptimized, and each loop that gets hot is replaced with optimized
+// code from then on. Tiered code is not to be profiled or checkpointed.
+void hgbf_code_tiered(uint32_t threshold);
+
+// Optimize the loop of tiered code numbered `slot`, store its kernel to the
+// loop and return it. The kernel runs the loop from its beginning to the end
+// and halts there.
+hgbf_code_t *hgbf_code_optimize_loop(hgbf_code_t *code, size_t slot);
+
+// Deepest nesting of loops in a script. Deeper scripts are rejected, for the
+// optimizer works on loops recursively.
+#define HGBF_CODE_DEPTH_MAX 1024
+
 // Parse script from input stream and generate code.
 // If error occurred, return NULL and record error message.
 hgbf_code_t *hgbf_code_compile(hgbf_istream_t *script);
 
+// Incremental compiler, which keeps unclosed `['s between pieces of script.
+typedef struct hgbf_compiler hgbf_compiler_t;
+
+// Create an incremental compiler.
+hgbf_compiler_t *hgbf_compiler_new(void);
+
+// Free the compiler.
+void hgbf_compiler_free(hgbf_compiler_t *compiler);
+
+// Parse a piece of script. If all `['s are closed, generate code for the
+// script fed so far and store it to `*code`, otherwise store NULL. The code
+// does not assume the cells to be zero. Return 0 on success; on failure,
+// discard the pending script, return -1 and record error message.
+int hgbf_compiler_feed(hgbf_compiler_t *compiler,
+	hgbf_istream_t *script, hgbf_code_t **code);
+
+// Parse the script until all `['s are closed after a segment of instructions,
+// or until the end, and store generated code to `*code`. The code of the first
+// segment assumes all cells to be zero, and the following segments continue
+// its evaluation. At the end of the script, store NULL. Return 0 on success;
+// on failure, return -1 and record error message.
+int hgbf_compiler_next(hgbf_compiler_t *compiler,
+	hgbf_istream_t *script, hgbf_code_t **code);
+
+// Calculate a hash value that identifies the code.
+uint64_t hgbf_code_hash(const hgbf_code_t *code);
+
 // Print code to stdout.
 void hgbf_code_dump(const hgbf_code_t *code);
 
@@ -1,186 +1,1006 @@
+#if !defined _WIN32
+#	define _POSIX_C_SOURCE 200809L // mmap(), fstat()
+#endif // _WIN32
+
 #include "eval.h"
 
 #include <assert.h>
 #include <setjmp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <time.h>
+
+#if !defined _WIN32
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif // _WIN32
 
+#include "arena.h"
 #include "code.h"
 #include "error.h"
+#include "lanes.h"
 #include "opcode.h"
+#include "profile.h"
 #include "stream.h"
 
+#if defined __GNUC__
+#	define ALWAYS_INLINE inline __attribute__((always_inline))
+#	define NOINLINE __attribute__((noinline))
+#elif defined _MSC_VER
+#	define ALWAYS_INLINE __forceinline
+#	define NOINLINE __declspec(noinline)
+#else
+#	define ALWAYS_INLINE inline
+#	define NOINLINE
+#endif
+
 static jmp_buf error_jumpbuf;
 
-#define CELLS_CHUNK_SIZE 128
+#ifdef HGBF_OPSTATS
+
+// Dynamic opcode pair counts, for choosing superinstructions.
+static uint64_t opstats_pairs[256][256];
+static unsigned char opstats_prev_op = (unsigned char)HGBF_OP_HLT;
 
-struct cells_chunk {
-	signed char cells[CELLS_CHUNK_SIZE - sizeof(void *) * 2];
-	struct cells_chunk *prev_chunk, *next_chunk;
+#define OPSTATS_COUNT(op) \
+	(opstats_pairs[opstats_prev_op][(op)]++, opstats_prev_op = (op))
+
+static const char *const opstats_op_name[] = {
+#define HGBF_OPCODE_LIST_ENTRY(NAME, CODE, OPRD) #NAME,
+	HGBF_OPCODE_LIST
+#undef HGBF_OPCODE_LIST_ENTRY
 };
 
-static_assert(sizeof(struct cells_chunk) == CELLS_CHUNK_SIZE,
-	"sizeof(struct cells_chunk) != CELLS_CHUNK_SIZE");
+#define OPSTATS_PRINT_MAX 32
+
+// Print the most frequent opcode pairs to stderr.
+static void opstats_print(void)
+{
+	const size_t op_count = sizeof opstats_op_name / sizeof opstats_op_name[0];
+	uint64_t total = 0;
+	for (size_t i = 0; i < op_count; i++) {
+		for (size_t j = 0; j < op_count; j++)
+			total += opstats_pairs[i][j];
+	}
+	fprintf(stderr, "opcode pairs: %llu\n", (unsigned long long)total);
+	for (size_t n = 0; n < OPSTATS_PRINT_MAX && total; n++) {
+		size_t max_i = 0, max_j = 0;
+		for (size_t i = 0; i < op_count; i++) {
+			for (size_t j = 0; j < op_count; j++) {
+				if (opstats_pairs[i][j] > opstats_pairs[max_i][max_j])
+					max_i = i, max_j = j;
+			}
+		}
+		const uint64_t count = opstats_pairs[max_i][max_j];
+		if (!count)
+			break;
+		fprintf(stderr, "%-6s %-6s %12llu %5.1f%%\n",
+			opstats_op_name[max_i], opstats_op_name[max_j],
+			(unsigned long long)count, (double)count * 100 / (double)total);
+		opstats_pairs[max_i][max_j] = 0;
+	}
+}
+
+#else // !HGBF_OPSTATS
+
+#define OPSTATS_COUNT(op) ((void)0)
+
+#endif // HGBF_OPSTATS
+
+#define CELLS_PAGE_SIZE 4096
+#define CELLS_RESERVE_MAX_PAGES 256
+
+// A page of cells. Pages are located by their index in the hash table.
+struct cells_page {
+	int64_t index; // Address of first cell divided by `CELLS_PAGE_SIZE`.
+	signed char *cells; // Cells; NULL if the slot is empty.
+};
 
 typedef struct {
-	struct cells_chunk *first_chunk;
+	struct cells_page *pages; // Open addressing hash table of pages.
+	size_t pages_mask; // Table capacity minus 1.
+	size_t page_count;
+	int64_t sought_first, sought_last; // Range of pages sought by iterators; empty if first > last.
+	hgbf_arena_t *arena; // Memory of the pages and the table.
 } cells_t;
 
 typedef struct {
 	signed char *cell;
-	const signed char *chunk_left, *chunk_right;
-	struct cells_chunk *chunk;
+	signed char *page_begin;
+	int64_t page_index;
 } cells_iter_t;
 
 static size_t cells_mem_max = 0, cells_mem_used = 0;
 
+// Arena of destroyed cells, kept for the next ones.
+static hgbf_arena_t *cells_spare_arena = NULL;
+
 noreturn static void _cells_error_oom(void)
 {
 	hgbf_err_record("out of memory (%zu B / %zu B)", cells_mem_used, cells_mem_max);
 	longjmp(error_jumpbuf, 1);
 }
 
-static void cells_init(cells_t *cells)
+static size_t _cells_hash(int64_t page_index)
 {
-	cells_mem_used += sizeof(struct cells_chunk);
-	struct cells_chunk *const new_chunk = malloc(sizeof(struct cells_chunk));
-	memset(new_chunk->cells, 0, sizeof new_chunk->cells);
-	new_chunk->prev_chunk = NULL;
-	new_chunk->next_chunk = NULL;
-	cells->first_chunk = new_chunk;
+	return (size_t)(((uint64_t)page_index * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
 }
 
-static void cells_destroy(cells_t *cells)
+static int64_t _cells_page_index(int64_t address)
+{
+	return (address - (address < 0 ? CELLS_PAGE_SIZE - 1 : 0)) / CELLS_PAGE_SIZE;
+}
+
+static struct cells_page *_cells_slot(
+	struct cells_page *pages, size_t pages_mask, int64_t page_index)
 {
-	for (struct cells_chunk *chunk = cells->first_chunk->prev_chunk; chunk; ) {
-		struct cells_chunk *const prev_chunk = chunk->prev_chunk;
-		free(chunk);
-		chunk = prev_chunk;
+	for (size_t i = _cells_hash(page_index); ; i++) {
+		struct cells_page *const slot = pages + (i & pages_mask);
+		if (!slot->cells || slot->index == page_index)
+			return slot;
 	}
-	for (struct cells_chunk *chunk = cells->first_chunk; chunk; ) {
-		struct cells_chunk *const next_chunk = chunk->next_chunk;
-		free(chunk);
-		chunk = next_chunk;
+}
+
+static void _cells_grow_table(cells_t *cells)
+{
+	const size_t new_capacity = (cells->pages_mask + 1) * 2;
+	// The old table stays in the arena until the cells are destroyed.
+	struct cells_page *const new_pages =
+		hgbf_arena_calloc(cells->arena, new_capacity * sizeof(struct cells_page));
+	if (!new_pages)
+		_cells_error_oom();
+	for (size_t i = 0; i <= cells->pages_mask; i++) {
+		const struct cells_page *const page = cells->pages + i;
+		if (page->cells)
+			*_cells_slot(new_pages, new_capacity - 1, page->index) = *page;
+	}
+	cells->pages = new_pages;
+	cells->pages_mask = new_capacity - 1;
+}
+
+// Find or create a page.
+static struct cells_page *_cells_page(cells_t *cells, int64_t page_index)
+{
+	struct cells_page *slot = _cells_slot(cells->pages, cells->pages_mask, page_index);
+	if (slot->cells)
+		return slot;
+
+	// The first page, which holds the start cell, is counted but always
+	// allowed, so that limits below a page size still let scripts run.
+	if (cells_mem_max && cells->page_count &&
+			cells_mem_used + CELLS_PAGE_SIZE > cells_mem_max)
+		_cells_error_oom();
+	cells_mem_used += CELLS_PAGE_SIZE;
+	signed char *const page_cells = hgbf_arena_calloc(cells->arena, CELLS_PAGE_SIZE);
+	if (!page_cells)
+		_cells_error_oom();
+
+	if ((cells->page_count + 1) * 2 > cells->pages_mask + 1) {
+		_cells_grow_table(cells);
+		slot = _cells_slot(cells->pages, cells->pages_mask, page_index);
 	}
+	slot->index = page_index;
+	slot->cells = page_cells;
+	cells->page_count++;
+	return slot;
 }
 
-static cells_iter_t _cells_iter_make(struct cells_chunk *chunk)
+// Use memory owned by the caller as the cells of a page, which are not
+// counted as used memory.
+static void _cells_set_page(cells_t *cells, int64_t page_index, signed char *page_cells)
 {
+	struct cells_page *slot = _cells_slot(cells->pages, cells->pages_mask, page_index);
+	if (!slot->cells) {
+		if ((cells->page_count + 1) * 2 > cells->pages_mask + 1) {
+			_cells_grow_table(cells);
+			slot = _cells_slot(cells->pages, cells->pages_mask, page_index);
+		}
+		slot->index = page_index;
+		cells->page_count++;
+	}
+	slot->cells = page_cells;
+}
+
+// Initialize empty cells. Pages are allocated on first access, within the
+// memory limit. Return -1 if out of memory.
+static int cells_init(cells_t *cells)
+{
+	const size_t n = 16;
+	cells->arena = cells_spare_arena ? cells_spare_arena : hgbf_arena_new();
+	cells_spare_arena = NULL;
+	cells->pages = cells->arena ?
+		hgbf_arena_calloc(cells->arena, n * sizeof(struct cells_page)) : NULL;
+	cells->pages_mask = n - 1;
+	cells->page_count = 0;
+	cells->sought_first = INT64_MAX;
+	cells->sought_last = INT64_MIN;
+	if (!cells->pages) {
+		hgbf_arena_free(cells->arena);
+		cells->arena = NULL;
+		hgbf_err_record("out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+static void cells_destroy(cells_t *cells)
+{
+	if (!cells->arena)
+		return;
+	hgbf_arena_reset(cells->arena);
+	if (!cells_spare_arena)
+		cells_spare_arena = cells->arena;
+	else
+		hgbf_arena_free(cells->arena);
+	cells->arena = NULL;
+	cells->pages = NULL;
+}
+
+// Allocate pages for cells range [min, max] in advance, if memory allows.
+static void cells_reserve(cells_t *cells, int64_t min, int64_t max)
+{
+	const int64_t first_page = _cells_page_index(min), last_page = _cells_page_index(max);
+	if (min > max || last_page - first_page >= CELLS_RESERVE_MAX_PAGES)
+		return;
+	const size_t size = (size_t)(last_page - first_page + 1) * CELLS_PAGE_SIZE;
+	if (cells_mem_max && cells_mem_used + size > cells_mem_max)
+		return;
+	for (int64_t i = first_page; i <= last_page; i++)
+		_cells_page(cells, i);
+}
+
+static cells_iter_t _cells_iter_seek(cells_t *cells, int64_t address)
+{
+	const int64_t page_index = _cells_page_index(address);
+	signed char *const page_begin = _cells_page(cells, page_index)->cells;
+	if (page_index < cells->sought_first)
+		cells->sought_first = page_index;
+	if (page_index > cells->sought_last)
+		cells->sought_last = page_index;
 	const cells_iter_t iter = {
-		.cell = chunk->cells,
-		.chunk_left = chunk->cells,
-		.chunk_right = chunk->cells + (sizeof chunk->cells - 1),
-		.chunk = chunk,
+		.cell = page_begin + (address - page_index * CELLS_PAGE_SIZE),
+		.page_begin = page_begin,
+		.page_index = page_index,
 	};
 	return iter;
 }
 
-static cells_iter_t cells_iter_make(cells_t *cells)
+// Zero cells that may have been written, which are the range [min, max] if it
+// is not empty, otherwise the pages sought since the last clear. Pages are
+// kept for reuse.
+static void cells_clear(cells_t *cells, int64_t min, int64_t max)
 {
-	return _cells_iter_make(cells->first_chunk);
+	if (min <= max) {
+		for (int64_t address = min; address <= max; ) {
+			const cells_iter_t iter = _cells_iter_seek(cells, address);
+			const int64_t rest = CELLS_PAGE_SIZE - (iter.cell - iter.page_begin);
+			const int64_t n = max - address + 1 < rest ? max - address + 1 : rest;
+			memset(iter.cell, 0, (size_t)n);
+			address += n;
+		}
+	} else if (cells->sought_first <= cells->sought_last &&
+			(uint64_t)(cells->sought_last - cells->sought_first) < cells->page_count) {
+		for (int64_t i = cells->sought_first; i <= cells->sought_last; i++) {
+			const struct cells_page *const page =
+				_cells_slot(cells->pages, cells->pages_mask, i);
+			if (page->cells)
+				memset(page->cells, 0, CELLS_PAGE_SIZE);
+		}
+	} else if (cells->sought_first <= cells->sought_last) {
+		// Sparse pages; fewer to visit in the table.
+		for (size_t i = 0; i <= cells->pages_mask; i++) {
+			const struct cells_page *const page = cells->pages + i;
+			if (page->cells && page->index >= cells->sought_first &&
+					page->index <= cells->sought_last)
+				memset(page->cells, 0, CELLS_PAGE_SIZE);
+		}
+	}
+	cells->sought_first = INT64_MAX;
+	cells->sought_last = INT64_MIN;
+}
+
+// Copy data to cells starting from the address.
+static void cells_write(cells_t *cells,
+	int64_t address, const unsigned char *data, size_t size)
+{
+	while (size) {
+		const cells_iter_t iter = _cells_iter_seek(cells, address);
+		const size_t rest = (size_t)(CELLS_PAGE_SIZE - (iter.cell - iter.page_begin));
+		const size_t n = size < rest ? size : rest;
+		memcpy(iter.cell, data, n);
+		address += (int64_t)n;
+		data += n;
+		size -= n;
+	}
 }
 
-static cells_iter_t _cells_iter_next_chunk(struct cells_chunk *chunk)
+// Add deltas to cells, cell by cell with 8-bit wraparound.
+static void cells_add_direct(
+	signed char *cells, const unsigned char *deltas, size_t size)
 {
-	struct cells_chunk *target_chunk = chunk->next_chunk;
-	if (!target_chunk) {
-		if (cells_mem_max && cells_mem_used + sizeof(struct cells_chunk) > cells_mem_max)
-			_cells_error_oom();
-		cells_mem_used += sizeof(struct cells_chunk);
-		struct cells_chunk *const new_chunk = malloc(sizeof(struct cells_chunk));
-		memset(new_chunk->cells, 0, sizeof new_chunk->cells);
-		new_chunk->prev_chunk = target_chunk;
-		new_chunk->next_chunk = NULL;
-		chunk->next_chunk = new_chunk;
-		target_chunk = new_chunk;
+	unsigned char *const p = (unsigned char *)cells;
+	size_t i = 0;
+	// Fixed-size chunks that compile to single vector additions.
+	for (; i + HGBF_ADDV_CHUNK <= size; i += HGBF_ADDV_CHUNK) {
+		for (size_t j = 0; j < HGBF_ADDV_CHUNK; j++)
+			p[i + j] += deltas[i + j];
 	}
-	return _cells_iter_make(target_chunk);
+	for (; i < size; i++)
+		p[i] += deltas[i];
 }
 
-static cells_iter_t _cells_iter_prev_chunk(struct cells_chunk *chunk)
+// Add deltas to cells starting from the address.
+static void cells_add(cells_t *cells,
+	int64_t address, const unsigned char *deltas, size_t size)
 {
-	struct cells_chunk *target_chunk = chunk->prev_chunk;
-	if (!target_chunk) {
-		if (cells_mem_max && cells_mem_used + sizeof(struct cells_chunk) > cells_mem_max)
-			_cells_error_oom();
-		cells_mem_used += sizeof(struct cells_chunk);
-		struct cells_chunk *const new_chunk = malloc(sizeof(struct cells_chunk));
-		memset(new_chunk->cells, 0, sizeof new_chunk->cells);
-		new_chunk->prev_chunk = NULL;
-		new_chunk->next_chunk = target_chunk;
-		chunk->prev_chunk = new_chunk;
-		target_chunk = new_chunk;
+	while (size) {
+		const cells_iter_t iter = _cells_iter_seek(cells, address);
+		const size_t rest = (size_t)(CELLS_PAGE_SIZE - (iter.cell - iter.page_begin));
+		const size_t n = size < rest ? size : rest;
+		cells_add_direct(iter.cell, deltas, n);
+		address += (int64_t)n;
+		deltas += n;
+		size -= n;
 	}
-	return _cells_iter_make(target_chunk);
 }
 
+#define cells_iter_address(iter) \
+	((iter).page_index * CELLS_PAGE_SIZE + ((iter).cell - (iter).page_begin))
+
 #define cells_iter_ref_cell(iter) \
 	((iter).cell)
 
-#define cells_iter_next(iter) \
+// Whether cells [-back, +fwd] are in the same page, thus directly addressable.
+#define cells_iter_has_range(iter, back, fwd) \
+	((size_t)((iter).cell - (iter).page_begin) >= (size_t)(back) && \
+	(size_t)(CELLS_PAGE_SIZE - 1 - ((iter).cell - (iter).page_begin)) >= (size_t)(fwd))
+
+#define cells_iter_next(cells, iter) \
 do { \
-	if ((iter).cell < (iter).chunk_right) \
+	if ((iter).cell - (iter).page_begin < CELLS_PAGE_SIZE - 1) \
 		(iter).cell++; \
 	else \
-		(iter) = _cells_iter_next_chunk((iter).chunk); \
+		(iter) = _cells_iter_seek((cells), cells_iter_address(iter) + 1); \
 } while (false)
 
-#define cells_iter_prev(iter) \
+#define cells_iter_prev(cells, iter) \
 do { \
-	if ((iter).cell > (iter).chunk_left) \
+	if ((iter).cell > (iter).page_begin) \
 		(iter).cell--; \
 	else \
-		(iter) = _cells_iter_prev_chunk((iter).chunk); \
+		(iter) = _cells_iter_seek((cells), cells_iter_address(iter) - 1); \
+} while (false)
+
+#define cells_iter_next_n(cells, iter, n) \
+do { \
+	if ((size_t)(CELLS_PAGE_SIZE - 1 - ((iter).cell - (iter).page_begin)) >= (n)) \
+		(iter).cell += (n); \
+	else \
+		(iter) = _cells_iter_seek((cells), cells_iter_address(iter) + (int64_t)(n)); \
 } while (false)
 
-#define cells_iter_next_n(iter, n_) \
-for (size_t n = (n_); ; ) { \
-	if ((iter).cell + n <= (iter).chunk_right) { \
-		(iter).cell += n; \
-		break; \
-	} \
-	n -= (iter).chunk_right - (iter).cell + 1; \
-	(iter) = _cells_iter_next_chunk((iter).chunk); \
+#define cells_iter_prev_n(cells, iter, n) \
+do { \
+	if ((size_t)((iter).cell - (iter).page_begin) >= (n)) \
+		(iter).cell -= (n); \
+	else \
+		(iter) = _cells_iter_seek((cells), cells_iter_address(iter) - (int64_t)(n)); \
+} while (false)
+
+// Bytes read from input and written to output by the current evaluation.
+static size_t eval_input_count, eval_output_count;
+
+// Loop back-edges taken, updated at polls and when an evaluation returns.
+static uint64_t eval_backedges;
+
+static bool eval_counting = false; // Whether to count executed instructions.
+static uint64_t eval_executed; // Executed instructions, if `eval_counting`.
+
+// Statistics of finished evaluations.
+static hgbf_eval_stats_t eval_stats;
+
+static hgbf_profile_t *eval_profile = NULL; // Profile to record to, or NULL.
+static bool eval_lanes = false; // Whether to evaluate batch records in lockstep.
+static const hgbf_code_t *profile_code; // Code being profiled, or NULL.
+static uint64_t (*profile_counts)[2]; // Loop entries and back-edges by code position.
+static size_t profile_counts_size;
+
+#define POLL_PERIOD 0x10000
+
+static uint64_t eval_steps_max = 0; // Maximum back-edges; 0 for no limit.
+static double eval_time_max = 0; // Maximum wall-clock seconds; 0 for no limit.
+static struct timespec eval_start, eval_deadline;
+
+// Counts of evaluations that continue one another, such as the segments of a
+// session, so that the limits apply to them as a whole.
+typedef struct {
+	uint64_t backedges;
+	size_t input_count, output_count;
+	double time_used; // Seconds, if there is a time limit.
+} eval_run_t;
+
+static const char *checkpoint_file = NULL;
+static size_t checkpoint_interval = 0;
+static volatile sig_atomic_t checkpoint_requested = 0;
+static uint64_t checkpoint_backedges;
+
+#define CHECKPOINT_MAGIC "HGBFCKPT"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t code_hash;
+	uint64_t code_offset;
+	int64_t data_address;
+	uint64_t input_offset;
+	uint64_t output_offset;
+	uint64_t page_count;
+};
+
+// Number of back-edges until the next poll; 0 if polling is not needed.
+static size_t poll_period(void)
+{
+	size_t period = 0;
+	if (checkpoint_file || eval_time_max > 0)
+		period = POLL_PERIOD;
+	if (checkpoint_file && checkpoint_interval && checkpoint_interval < period)
+		period = checkpoint_interval;
+	if (eval_steps_max) {
+		// Poll right after the last allowed back-edge.
+		assert(eval_backedges <= eval_steps_max);
+		const uint64_t rest = eval_steps_max - eval_backedges + 1;
+		if (!period || rest < period)
+			period = rest > SIZE_MAX ? SIZE_MAX : (size_t)rest;
+	}
+	return period;
+}
+
+static bool _page_is_zero(const signed char *cells)
+{
+	for (size_t i = 0; i < CELLS_PAGE_SIZE; i++) {
+		if (cells[i])
+			return false;
+	}
+	return true;
+}
+
+// Write evaluation state to the checkpoint file. Pages of zeros are omitted.
+static int checkpoint_save(const hgbf_code_t *code, const unsigned char *cp,
+	int64_t address, hgbf_ostream_t *output, const cells_t *cells)
+{
+	if (hgbf_ostream_flush(output))
+		return -1;
+
+	struct checkpoint_header header;
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof header.magic);
+	header.version = CHECKPOINT_VERSION;
+	header.page_size = CELLS_PAGE_SIZE;
+	header.code_hash = hgbf_code_hash(code);
+	header.code_offset = (uint64_t)(cp - code->bytes);
+	header.data_address = address;
+	header.input_offset = eval_input_count;
+	header.output_offset = eval_output_count;
+	header.page_count = 0;
+	for (size_t i = 0; i <= cells->pages_mask; i++) {
+		const struct cells_page *const page = cells->pages + i;
+		if (page->cells && !_page_is_zero(page->cells))
+			header.page_count++;
+	}
+
+	const size_t path_len = strlen(checkpoint_file);
+	char *const temp_path = malloc(path_len + 5);
+	memcpy(temp_path, checkpoint_file, path_len);
+	memcpy(temp_path + path_len, ".tmp", 5);
+	FILE *const fp = fopen(temp_path, "wb");
+	bool ok = fp && fwrite(&header, sizeof header, 1, fp) == 1;
+	for (size_t i = 0; ok && i <= cells->pages_mask; i++) {
+		const struct cells_page *const page = cells->pages + i;
+		if (!page->cells || _page_is_zero(page->cells))
+			continue;
+		ok = fwrite(&page->index, sizeof page->index, 1, fp) == 1 &&
+			fwrite(page->cells, CELLS_PAGE_SIZE, 1, fp) == 1;
+	}
+	if (fp && fclose(fp))
+		ok = false;
+	if (ok && rename(temp_path, checkpoint_file)) {
+		// Renaming onto an existing file fails on some platforms.
+		remove(checkpoint_file);
+		ok = !rename(temp_path, checkpoint_file);
+	}
+	free(temp_path);
+	return ok ? 0 : -1;
+}
+
+// Read evaluation state from the checkpoint file. Return the code offset,
+// or (size_t)-1 on failure.
+static size_t checkpoint_load(const char *file, const hgbf_code_t *code,
+	int64_t *address, hgbf_eval_io_t io, cells_t *cells)
+{
+	FILE *const fp = fopen(file, "rb");
+	if (!fp) {
+		hgbf_err_record("cannot open checkpoint %s", file);
+		return (size_t)-1;
+	}
+
+	struct checkpoint_header header;
+	size_t ret = (size_t)-1;
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+			memcmp(header.magic, CHECKPOINT_MAGIC, sizeof header.magic) ||
+			header.version != CHECKPOINT_VERSION ||
+			header.page_size != CELLS_PAGE_SIZE) {
+		hgbf_err_record("%s is not a valid checkpoint", file);
+		goto end;
+	}
+	if (header.code_hash != hgbf_code_hash(code) ||
+			header.code_offset >= code->length) {
+		hgbf_err_record("checkpoint %s does not match the code", file);
+		goto end;
+	}
+
+	for (uint64_t i = 0; i < header.page_count; i++) {
+		int64_t index;
+		if (fread(&index, sizeof index, 1, fp) != 1 ||
+				fread(_cells_page(cells, index)->cells, CELLS_PAGE_SIZE, 1, fp) != 1) {
+			hgbf_err_record("checkpoint %s is truncated", file);
+			goto end;
+		}
+	}
+
+	if (hgbf_istream_skip(io.i, (size_t)header.input_offset)) {
+		hgbf_err_record("input error");
+		goto end;
+	}
+	// Output before the checkpoint is rewritten in place, which needs a file.
+	if (header.output_offset && hgbf_ostream_seek(io.o, (size_t)header.output_offset)) {
+		hgbf_err_record("cannot seek output to the checkpoint");
+		goto end;
+	}
+	eval_input_count = (size_t)header.input_offset;
+	eval_output_count = (size_t)header.output_offset;
+	*address = header.data_address;
+	ret = (size_t)header.code_offset;
+
+end:
+	fclose(fp);
+	return ret;
 }
 
-#define cells_iter_prev_n(iter, n_) \
-for (size_t n = (n_); ; ) { \
-	if ((iter).cell - n >= (iter).chunk_left) { \
-		(iter).cell -= n; \
-		break; \
-	} \
-	n -= (iter).cell - (iter).chunk_left + 1; \
-	(iter) = _cells_iter_prev_chunk((iter).chunk); \
+#define TAPE_FILE_MAGIC "HGBFTAPE"
+#define TAPE_FILE_VERSION 1
+
+// Header of tape files. Cells from `first_address` follow at file offset
+// `page_size`, so that they can be used in place when the file is mapped.
+struct tape_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	int64_t first_address; // A multiple of `page_size`.
+	uint64_t page_count;
+	int64_t data_address;
+};
+
+// A tape file mapped into memory.
+typedef struct {
+	unsigned char *data; // NULL if not mapped.
+	size_t size;
+} tape_map_t;
+
+static bool _tape_header_is_valid(const struct tape_file_header *header, uint64_t file_size)
+{
+	return !memcmp(header->magic, TAPE_FILE_MAGIC, sizeof header->magic) &&
+		header->version == TAPE_FILE_VERSION &&
+		header->page_size == CELLS_PAGE_SIZE &&
+		header->first_address % CELLS_PAGE_SIZE == 0 &&
+		file_size / CELLS_PAGE_SIZE > header->page_count;
+}
+
+// Load cells and the data pointer from a tape file. The file is mapped
+// privately where supported, and the cells are used in place without changing
+// the file. Return 0 on success; on failure, return -1 and record error message.
+static int tape_load(const char *file,
+	cells_t *cells, int64_t *address, tape_map_t *map)
+{
+	struct tape_file_header header;
+	map->data = NULL;
+
+#if !defined _WIN32
+	const int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		hgbf_err_record("cannot open tape %s", file);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || read(fd, &header, sizeof header) != sizeof header ||
+			!_tape_header_is_valid(&header, (uint64_t)st.st_size)) {
+		close(fd);
+		hgbf_err_record("%s is not a valid tape file", file);
+		return -1;
+	}
+	map->size = (size_t)(header.page_count + 1) * CELLS_PAGE_SIZE;
+	void *const data = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		hgbf_err_record("cannot map tape %s", file);
+		return -1;
+	}
+	map->data = data;
+	const int64_t first_page = header.first_address / CELLS_PAGE_SIZE;
+	for (uint64_t i = 0; i < header.page_count; i++) {
+		_cells_set_page(cells, first_page + (int64_t)i,
+			(signed char *)map->data + (i + 1) * CELLS_PAGE_SIZE);
+	}
+#else // _WIN32
+	FILE *const fp = fopen(file, "rb");
+	if (!fp) {
+		hgbf_err_record("cannot open tape %s", file);
+		return -1;
+	}
+	bool ok = fread(&header, sizeof header, 1, fp) == 1 &&
+		_tape_header_is_valid(&header, UINT64_MAX) &&
+		!fseek(fp, CELLS_PAGE_SIZE, SEEK_SET);
+	const int64_t first_page = header.first_address / CELLS_PAGE_SIZE;
+	for (uint64_t i = 0; ok && i < header.page_count; i++) {
+		ok = fread(_cells_page(cells, first_page + (int64_t)i)->cells,
+			CELLS_PAGE_SIZE, 1, fp) == 1;
+	}
+	fclose(fp);
+	if (!ok) {
+		hgbf_err_record("%s is not a valid tape file", file);
+		return -1;
+	}
+#endif // _WIN32
+
+	*address = header.data_address;
+	return 0;
+}
+
+// Store cells and the data pointer to a tape file, which is replaced as a
+// whole. Return 0 on success; on failure, return -1 and record error message.
+static int tape_save(const char *file, const cells_t *cells, int64_t address)
+{
+	int64_t first_page = INT64_MAX, last_page = INT64_MIN;
+	for (size_t i = 0; i <= cells->pages_mask; i++) {
+		const struct cells_page *const page = cells->pages + i;
+		if (!page->cells || _page_is_zero(page->cells))
+			continue;
+		if (page->index < first_page)
+			first_page = page->index;
+		if (page->index > last_page)
+			last_page = page->index;
+	}
+	if (first_page > last_page)
+		first_page = 0, last_page = -1;
+
+	struct tape_file_header header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, TAPE_FILE_MAGIC, sizeof header.magic);
+	header.version = TAPE_FILE_VERSION;
+	header.page_size = CELLS_PAGE_SIZE;
+	header.first_address = first_page * CELLS_PAGE_SIZE;
+	header.page_count = (uint64_t)(last_page - first_page + 1);
+	header.data_address = address;
+
+	// Write a new file and replace the old one, which may still be mapped.
+	static const signed char zeros[CELLS_PAGE_SIZE];
+	const size_t path_len = strlen(file);
+	char *const temp_path = malloc(path_len + 5);
+	memcpy(temp_path, file, path_len);
+	memcpy(temp_path + path_len, ".tmp", 5);
+	FILE *const fp = fopen(temp_path, "wb");
+	bool ok = fp && fwrite(&header, sizeof header, 1, fp) == 1 &&
+		fwrite(zeros, CELLS_PAGE_SIZE - sizeof header, 1, fp) == 1;
+	for (int64_t index = first_page; ok && index <= last_page; index++) {
+		const struct cells_page *const page =
+			_cells_slot(cells->pages, cells->pages_mask, index);
+		ok = fwrite(page->cells ? page->cells : zeros, CELLS_PAGE_SIZE, 1, fp) == 1;
+	}
+	if (fp && fclose(fp))
+		ok = false;
+	if (ok && rename(temp_path, file)) {
+		// Renaming onto an existing file fails on some platforms.
+		remove(file);
+		ok = !rename(temp_path, file);
+	}
+	free(temp_path);
+	if (!ok) {
+		hgbf_err_record("cannot write tape %s", file);
+		return -1;
+	}
+	return 0;
+}
+
+// Unmap the tape file.
+static void tape_unmap(tape_map_t *map)
+{
+#if !defined _WIN32
+	if (map->data)
+		munmap(map->data, map->size);
+#endif // _WIN32
+	map->data = NULL;
+}
+
+// Called every `poll_period()` back-edges.
+static int eval_poll(const hgbf_code_t *code, const unsigned char *cp,
+	int64_t address, hgbf_ostream_t *output, const cells_t *cells, size_t period)
+{
+	eval_backedges += period;
+
+	if (eval_steps_max && eval_backedges > eval_steps_max) {
+		hgbf_err_record("step limit exceeded (%llu loop iterations)",
+			(unsigned long long)eval_steps_max);
+		return -1;
+	}
+
+	if (eval_time_max > 0) {
+		struct timespec now;
+		timespec_get(&now, TIME_UTC);
+		if (now.tv_sec > eval_deadline.tv_sec || (now.tv_sec == eval_deadline.tv_sec
+				&& now.tv_nsec >= eval_deadline.tv_nsec)) {
+			hgbf_err_record("time limit exceeded (%g s)", eval_time_max);
+			return -1;
+		}
+	}
+
+	if (checkpoint_requested || (checkpoint_interval &&
+			eval_backedges - checkpoint_backedges >= checkpoint_interval)) {
+		checkpoint_requested = 0;
+		checkpoint_backedges = eval_backedges;
+		if (checkpoint_save(code, cp, address, output, cells)) {
+			hgbf_err_record("failed to write checkpoint %s", checkpoint_file);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Add ADDV deltas to cells starting from offset `first` to the iterator.
+static void cells_iter_add(cells_t *cells, cells_iter_t iter,
+	int32_t first, const unsigned char *deltas, size_t size)
+{
+	const int64_t last = (int64_t)first + (int64_t)size - 1;
+	if (cells_iter_has_range(iter, first < 0 ? -(int64_t)first : 0, last > 0 ? last : 0)) {
+		cells_add_direct(cells_iter_ref_cell(iter) + first, deltas, size);
+	} else {
+		while (!deltas[size - 1])
+			size--; // Do not touch cells out of the window.
+		cells_add(cells, cells_iter_address(iter) + first, deltas, size);
+	}
+}
+
+// Get the cell at `offset` from the iterator.
+static ALWAYS_INLINE signed char *cells_iter_at(cells_t *cells, cells_iter_t iter, int32_t offset)
+{
+	if (cells_iter_has_range(iter, offset < 0 ? -(int64_t)offset : 0, offset > 0 ? offset : 0))
+		return cells_iter_ref_cell(iter) + offset;
+	return _cells_iter_seek(cells, cells_iter_address(iter) + offset).cell;
+}
+
+// Run the linear loop at the iterator in closed form with SOLVE terms. If it
+// never ends, leave the cells as they are, to the loop around.
+static void cells_iter_solve(cells_t *cells, cells_iter_t iter,
+	unsigned char step, const unsigned char *terms, size_t size)
+{
+	const int trips = hgbf_trip_count((unsigned char)*cells_iter_ref_cell(iter), step);
+	if (trips <= 0)
+		return;
+	for (const unsigned char *term = terms; term < terms + size; term += HGBF_SOLVE_TERM_SIZE) {
+		int32_t target, source;
+		memcpy(&target, term, 4);
+		memcpy(&source, term + 4, 4);
+		unsigned int amount = (unsigned int)trips * term[8];
+		if (source)
+			amount *= (unsigned char)*cells_iter_at(cells, iter, source);
+		signed char *const cell = cells_iter_at(cells, iter, target);
+		*cell = (signed char)(unsigned char)((unsigned char)*cell + amount);
+	}
+	*cells_iter_ref_cell(iter) = 0;
+}
+
+// Output cells from the iterator until a zero one, as `[.>]' does, and return
+// the iterator there. Each cell output after the first, or every one if `more`,
+// is a back-edge of the loop that counts `*countdown` down. When it runs out,
+// stop and set `*status` to 1, so that the caller polls and calls again with
+// `more`. Otherwise set `*status` to 0, or -1 on failure.
+static cells_iter_t cells_iter_print(cells_t *cells, cells_iter_t iter,
+	hgbf_ostream_t *output, size_t *countdown, bool more, int *status)
+{
+	*status = 0;
+	size_t first = more ? 0 : 1; // Cells to output before back-edges.
+	while (*cells_iter_ref_cell(iter)) {
+		const size_t rest = (size_t)(CELLS_PAGE_SIZE - (iter.cell - iter.page_begin));
+		signed char *const zero = memchr(iter.cell, 0, rest);
+		size_t n = zero ? (size_t)(zero - iter.cell) : rest;
+		if (n - first > *countdown)
+			n = *countdown + first;
+		if (hgbf_ostream_write(output, iter.cell, n)) {
+			*status = -1;
+			break;
+		}
+		eval_output_count += n;
+		*countdown -= n - first;
+		first = 0;
+		if (n < rest)
+			iter.cell += n;
+		else
+			iter = _cells_iter_seek(cells, cells_iter_address(iter) + (int64_t)n);
+		if (!*countdown) {
+			*status = 1;
+			break;
+		}
+	}
+	return iter;
+}
+
+// Copy input to output until a zero byte, as `,[.,]' does. Each byte copied
+// after the first, or every one if `more`, is a back-edge of the loop that
+// counts `*countdown` down. When it runs out, return 1, so that the caller
+// polls and calls again with `more`. Otherwise return 0, or -1 on failure.
+static int eval_cat(hgbf_istream_t *input, hgbf_ostream_t *output,
+	size_t *countdown, bool more)
+{
+	if (!more) {
+		const int c = hgbf_istream_read1(input);
+		if (c < 0) {
+			hgbf_err_record("input error");
+			return -1;
+		}
+		eval_input_count++;
+		if (!c)
+			return 0;
+		if (hgbf_ostream_write1(output, (unsigned char)c)) {
+			hgbf_err_record("output error");
+			return -1;
+		}
+		eval_output_count++;
+	}
+	size_t size;
+	const int ret = hgbf_istream_copy(input, output, *countdown, &size);
+	eval_input_count += size;
+	eval_output_count += size;
+	*countdown -= size;
+	if (ret == 2)
+		return 1;
+	if (ret) {
+		hgbf_err_record(ret < 0 ? "output error" : "input error");
+		return -1;
+	}
+	eval_input_count++; // The zero byte.
+	return 0;
 }
 
 static int eval(
-	const hgbf_code_t *code,
+	hgbf_code_t *code, size_t start, int64_t *address,
 	hgbf_istream_t *input, hgbf_ostream_t *output,
-	cells_t *cells)
+	cells_t *cells);
+
+// Number of words that hold `size` bytes of data in aligned code.
+#define DATA_WORDS(size) (((size) + sizeof(hgbf_word_t) - 1) / sizeof(hgbf_word_t))
+
+// Evaluate code from byte offset `start`. The data pointer starts from
+// `*address`, where it is stored back when the evaluation finishes. The code is
+// of the aligned layout if `aligned`, otherwise packed. Executed instructions
+// are counted only if `counting`, and loops are counted to `profile_counts`
+// only if `profiling`. All three are constants in each variant of the function.
+static ALWAYS_INLINE int eval_code(
+	hgbf_code_t *code, size_t start, int64_t *address,
+	hgbf_istream_t *input, hgbf_ostream_t *output,
+	cells_t *cells, bool aligned, bool counting, bool profiling)
 {
-	register const unsigned char *cp = code->bytes; // Code pointer.
-	register cells_iter_t dp = cells_iter_make(cells); // Data pointer.
+	register const unsigned char *cp = code->bytes + start; // Code pointer.
+	register cells_iter_t dp = _cells_iter_seek(cells, *address); // Data pointer.
+	size_t poll_period_ = poll_period();
+	size_t poll_countdown = poll_period_ ? poll_period_ : SIZE_MAX;
+	uint64_t executed = 0;
+
+	// Operand `FIELD` of the instruction word, or the operand of type `TYPE`
+	// at `OFFSET` after the opcode in packed code.
+#define EVAL_OPERAND(TYPE, FIELD, OFFSET) \
+	(aligned ? (TYPE)word->FIELD : *(const TYPE *)(cp + (OFFSET)))
+
+	// Raw data after the operands, which take `SIZE` bytes in packed code.
+#define EVAL_DATA(SIZE) \
+	(aligned ? cp : cp + (SIZE))
+
+	// Move to the next instruction, past the operands and `DATA_SIZE` bytes of data.
+#define EVAL_SKIP(SIZE, DATA_SIZE) \
+	(cp += aligned ? DATA_WORDS(DATA_SIZE) * sizeof(hgbf_word_t) : (SIZE) + (DATA_SIZE))
+
+	// Target of the `j' operand at `OFFSET`, the last operand in packed code.
+#define EVAL_TARGET(OFFSET) \
+	(aligned ? code->bytes + (ptrdiff_t)word->i * (ptrdiff_t)sizeof(hgbf_word_t) : \
+		cp + (OFFSET) + 4 + *(const int32_t *)(cp + (OFFSET)))
+
+	// Index of the instruction at `P` in `profile_counts`.
+#define EVAL_INDEX(P) \
+	((size_t)((P) - code->bytes) / (aligned ? sizeof(hgbf_word_t) : 1))
+
+	// Return, adding up the instructions and the back-edges not yet polled.
+#define EVAL_RETURN(VALUE) \
+	do { \
+		eval_executed += executed; \
+		eval_backedges += (poll_period_ ? poll_period_ : SIZE_MAX) - poll_countdown; \
+		return (VALUE); \
+	} while (0)
+
+	// Poll as `poll_countdown` runs out, to resume from `RESUME` if it checkpoints.
+#define EVAL_POLL(RESUME) \
+	do { \
+		poll_countdown = poll_period_; /* Counted by eval_poll(). */ \
+		if (eval_poll(code, (RESUME), cells_iter_address(dp), \
+				output, cells, poll_period_)) \
+			EVAL_RETURN(-1); \
+		poll_period_ = poll_period(); \
+		poll_countdown = poll_period_ ? poll_period_ : SIZE_MAX; \
+	} while (0)
+
+	// Jump backward to `TARGET`, polling every `poll_period_` jumps.
+#define EVAL_BACK_EDGE(TARGET) \
+	do { \
+		cp = (TARGET); \
+		if (profiling) \
+			profile_counts[EVAL_INDEX(cp)][1]++; \
+		if (!--poll_countdown) \
+			EVAL_POLL(cp); \
+	} while (0)
+
+	// Jump backward by the `j' operand at `OFFSET` if data is nonzero.
+#define EVAL_JBN(OFFSET) \
+	do { \
+		if (*cells_iter_ref_cell(dp)) \
+			EVAL_BACK_EDGE(EVAL_TARGET(OFFSET)); \
+		else \
+			EVAL_SKIP((OFFSET) + 4, 0); \
+	} while (0)
+
+	// Run the kernel of a tiered loop from the data pointer, which it leaves
+	// where the loop ends. Back-edges not yet polled are added up first, as
+	// the kernel polls on its own.
+#define EVAL_KERNEL(KERNEL) \
+	do { \
+		hgbf_code_t *const kernel_ = (KERNEL); \
+		eval_backedges += (poll_period_ ? poll_period_ : SIZE_MAX) - poll_countdown; \
+		poll_countdown = poll_period_ ? poll_period_ : SIZE_MAX; \
+		tempval.address = cells_iter_address(dp); \
+		if (eval(kernel_, 0, &tempval.address, input, output, cells)) \
+			EVAL_RETURN(-1); \
+		dp = _cells_iter_seek(cells, tempval.address); \
+		poll_period_ = poll_period(); \
+		poll_countdown = poll_period_ ? poll_period_ : SIZE_MAX; \
+	} while (0)
 
 	while (true) {
-		const unsigned char opcode = *cp++;
+		// The word is only read in aligned code.
+		const hgbf_word_t *const word = aligned ? (const hgbf_word_t *)cp : NULL;
+		const unsigned char opcode = aligned ? word->op : *cp;
+		cp += aligned ? sizeof(hgbf_word_t) : 1;
+		OPSTATS_COUNT(opcode);
+		if (counting)
+			executed++;
 
 		switch (opcode) {
 			union {
 				int int_;
-				ptrdiff_t offset;
 				size_t size;
+				int64_t address;
 			} tempval;
 
 		case (unsigned char)HGBF_OP_NXT:
-			cells_iter_next(dp);
+			cells_iter_next(cells, dp);
 			break;
 
 		case (unsigned char)HGBF_OP_PRV:
-			cells_iter_prev(dp);
+			cells_iter_prev(cells, dp);
 			break;
 
 		case (unsigned char)HGBF_OP_INC:
@@ -196,80 +1016,684 @@ static int eval(
 				output, (unsigned char)*cells_iter_ref_cell(dp));
 			if (tempval.int_) {
 				hgbf_err_record("output error");
-				return -1;
+				EVAL_RETURN(-1);
 			}
+			eval_output_count++;
 			break;
 
 		case (unsigned char)HGBF_OP_IN:
 			tempval.int_ = hgbf_istream_read1(input);
 			if (tempval.int_ < 0) {
 				hgbf_err_record("input error");
-				return -1;
+				EVAL_RETURN(-1);
 			}
+			eval_input_count++;
 			*cells_iter_ref_cell(dp) = (signed char)(unsigned char)tempval.int_;
 			break;
 
 		case (unsigned char)HGBF_OP_JFZ:
-			tempval.offset = (ptrdiff_t)*(uint32_t *)cp;
-			cp += 4;
-			if (!*cells_iter_ref_cell(dp))
-				cp += tempval.offset;
+			if (!*cells_iter_ref_cell(dp)) {
+				cp = EVAL_TARGET(0);
+				break;
+			}
+			if (profiling)
+				profile_counts[EVAL_INDEX(cp) - 1][0]++;
+			EVAL_SKIP(4, 0);
+			break;
+
+		case (unsigned char)HGBF_OP_JFN:
+			if (*cells_iter_ref_cell(dp))
+				cp = EVAL_TARGET(0);
+			else
+				EVAL_SKIP(4, 0);
 			break;
 
 		case (unsigned char)HGBF_OP_JBN:
-			tempval.offset = (ptrdiff_t)*(uint32_t *)cp;
-			cp += 4;
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_JBNs: // Packed code only.
 			if (*cells_iter_ref_cell(dp))
-				cp -= tempval.offset;
+				EVAL_BACK_EDGE(cp + 1 - *cp);
+			else
+				cp++;
+			break;
+
+		case (unsigned char)HGBF_OP_TJFZ:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 0);
+			if (!*cells_iter_ref_cell(dp)) {
+				cp = EVAL_TARGET(2);
+			} else if (code->hot[tempval.size].kernel) {
+				EVAL_KERNEL(code->hot[tempval.size].kernel);
+				cp = EVAL_TARGET(2);
+			} else {
+				EVAL_SKIP(6, 0);
+			}
+			break;
+
+		case (unsigned char)HGBF_OP_TJBN:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 0);
+			if (*cells_iter_ref_cell(dp)) {
+				if (!code->hot[tempval.size].kernel && !--code->hot[tempval.size].countdown)
+					hgbf_code_optimize_loop(code, tempval.size);
+				if (code->hot[tempval.size].kernel) {
+					EVAL_KERNEL(code->hot[tempval.size].kernel);
+					EVAL_SKIP(6, 0);
+					break;
+				}
+			}
+			EVAL_JBN(2);
 			break;
 
 		case (unsigned char)HGBF_OP_HLT:
-			return 0;
+			*address = cells_iter_address(dp);
+			EVAL_RETURN(0);
 
 		case (unsigned char)HGBF_OP_NXTn:
-			tempval.size = (size_t)*(uint16_t *)cp;
-			cp += 2;
-			cells_iter_next_n(dp, tempval.size);
+			tempval.size = EVAL_OPERAND(uint16_t, h, 0);
+			EVAL_SKIP(2, 0);
+			cells_iter_next_n(cells, dp, tempval.size);
 			break;
 
 		case (unsigned char)HGBF_OP_PRVn:
-			tempval.size = (size_t)*(uint16_t *)cp;
-			cp += 2;
-			cells_iter_prev_n(dp, tempval.size);
+			tempval.size = EVAL_OPERAND(uint16_t, h, 0);
+			EVAL_SKIP(2, 0);
+			cells_iter_prev_n(cells, dp, tempval.size);
 			break;
 
 		case (unsigned char)HGBF_OP_INCn:
-			(*cells_iter_ref_cell(dp)) += (signed char)*cp++;
+			(*cells_iter_ref_cell(dp)) += (signed char)EVAL_OPERAND(uint8_t, b, 0);
+			EVAL_SKIP(1, 0);
 			break;
 
 		case (unsigned char)HGBF_OP_DECn:
-			(*cells_iter_ref_cell(dp)) -= (signed char)*cp++;
+			(*cells_iter_ref_cell(dp)) -= (signed char)EVAL_OPERAND(uint8_t, b, 0);
+			EVAL_SKIP(1, 0);
+			break;
+
+		case (unsigned char)HGBF_OP_UNXT:
+			cells_iter_ref_cell(dp)++;
+			break;
+
+		case (unsigned char)HGBF_OP_UPRV:
+			cells_iter_ref_cell(dp)--;
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTn:
+			cells_iter_ref_cell(dp) += EVAL_OPERAND(uint16_t, h, 0);
+			EVAL_SKIP(2, 0);
+			break;
+
+		case (unsigned char)HGBF_OP_UPRVn:
+			cells_iter_ref_cell(dp) -= EVAL_OPERAND(uint16_t, h, 0);
+			EVAL_SKIP(2, 0);
+			break;
+
+		case (unsigned char)HGBF_OP_ENSR:
+			if (!cells_iter_has_range(dp,
+					EVAL_OPERAND(uint8_t, b, 0), EVAL_OPERAND(uint16_t, h, 1)))
+				cp = EVAL_TARGET(3);
+			else
+				EVAL_SKIP(7, 0);
+			break;
+
+		case (unsigned char)HGBF_OP_JMP:
+			cp = EVAL_TARGET(0);
+			break;
+
+		case (unsigned char)HGBF_OP_LOAD:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 4);
+			cells_write(cells, cells_iter_address(dp) + EVAL_OPERAND(int32_t, i, 0),
+				EVAL_DATA(6), tempval.size);
+			EVAL_SKIP(6, tempval.size);
+			break;
+
+		case (unsigned char)HGBF_OP_PUT:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 0);
+			if (hgbf_ostream_write(output, EVAL_DATA(2), tempval.size)) {
+				hgbf_err_record("output error");
+				EVAL_RETURN(-1);
+			}
+			eval_output_count += tempval.size;
+			EVAL_SKIP(2, tempval.size);
+			break;
+
+		case (unsigned char)HGBF_OP_DECJBN:
+			(*cells_iter_ref_cell(dp))--;
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_NXTJBN:
+			cells_iter_next(cells, dp);
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_PRVJBN:
+			cells_iter_prev(cells, dp);
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTJBN:
+			cells_iter_ref_cell(dp)++;
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_UPRVJBN:
+			cells_iter_ref_cell(dp)--;
+			EVAL_JBN(0);
+			break;
+
+		case (unsigned char)HGBF_OP_NXTINC:
+			cells_iter_next(cells, dp);
+			(*cells_iter_ref_cell(dp))++;
+			break;
+
+		case (unsigned char)HGBF_OP_INCNXT:
+			(*cells_iter_ref_cell(dp))++;
+			cells_iter_next(cells, dp);
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTINC:
+			(*++cells_iter_ref_cell(dp))++;
+			break;
+
+		case (unsigned char)HGBF_OP_INCUNXT:
+			(*cells_iter_ref_cell(dp)++)++;
+			break;
+
+		case (unsigned char)HGBF_OP_ADDV:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 4);
+			cells_iter_add(cells, dp, EVAL_OPERAND(int32_t, i, 0), EVAL_DATA(6), tempval.size);
+			EVAL_SKIP(6, tempval.size);
+			break;
+
+		case (unsigned char)HGBF_OP_SOLVE:
+			tempval.size = EVAL_OPERAND(uint16_t, h, 1);
+			cells_iter_solve(cells, dp, EVAL_OPERAND(uint8_t, b, 0), EVAL_DATA(3), tempval.size);
+			EVAL_SKIP(3, tempval.size);
+			break;
+
+		// The loops of OUTZ and CAT poll like others, and resume from the
+		// instruction, which has no operands.
+		case (unsigned char)HGBF_OP_OUTZ:
+			dp = cells_iter_print(cells, dp, output, &poll_countdown, false, &tempval.int_);
+			while (tempval.int_ > 0) {
+				EVAL_POLL(cp - (aligned ? sizeof(hgbf_word_t) : 1));
+				dp = cells_iter_print(cells, dp, output, &poll_countdown, true, &tempval.int_);
+			}
+			if (tempval.int_) {
+				hgbf_err_record("output error");
+				EVAL_RETURN(-1);
+			}
+			break;
+
+		case (unsigned char)HGBF_OP_CAT:
+			tempval.int_ = eval_cat(input, output, &poll_countdown, false);
+			while (tempval.int_ > 0) {
+				EVAL_POLL(cp - (aligned ? sizeof(hgbf_word_t) : 1));
+				tempval.int_ = eval_cat(input, output, &poll_countdown, true);
+			}
+			if (tempval.int_)
+				EVAL_RETURN(-1);
+			*cells_iter_ref_cell(dp) = 0;
 			break;
 
 		default:
-			hgbf_err_record("internal error: unkown opcode 0x%02x (CP=0x%02x)",
-				opcode, (cp - 1 - code->bytes));
-			return -1;
+			hgbf_err_record("internal error: unkown opcode 0x%02x (CP=0x%02zx)",
+				opcode, EVAL_INDEX(cp) - 1);
+			EVAL_RETURN(-1);
 		}
 	}
+
+#undef EVAL_KERNEL
+#undef EVAL_JBN
+#undef EVAL_BACK_EDGE
+#undef EVAL_POLL
+#undef EVAL_RETURN
+#undef EVAL_INDEX
+#undef EVAL_TARGET
+#undef EVAL_SKIP
+#undef EVAL_DATA
+#undef EVAL_OPERAND
+}
+
+#define EVAL_VARIANT(NAME, ALIGNED, COUNTING, PROFILING) \
+	static NOINLINE int NAME( \
+		hgbf_code_t *code, size_t start, int64_t *address, \
+		hgbf_istream_t *input, hgbf_ostream_t *output, cells_t *cells) \
+	{ \
+		return eval_code(code, start, address, input, output, cells, \
+			ALIGNED, COUNTING, PROFILING); \
+	}
+
+EVAL_VARIANT(eval_packed_plain, false, false, false)
+EVAL_VARIANT(eval_packed_counting, false, true, false)
+EVAL_VARIANT(eval_packed_profiling, false, true, true)
+EVAL_VARIANT(eval_aligned_plain, true, false, false)
+EVAL_VARIANT(eval_aligned_counting, true, true, false)
+EVAL_VARIANT(eval_aligned_profiling, true, true, true)
+
+#undef EVAL_VARIANT
+
+// Prepare `profile_counts` for the code.
+static void profile_begin(const hgbf_code_t *code)
+{
+	if (profile_counts_size < code->length + 1) {
+		free(profile_counts);
+		profile_counts_size = code->length + 1;
+		profile_counts = malloc(sizeof *profile_counts * profile_counts_size);
+	}
+	memset(profile_counts, 0, sizeof *profile_counts * (code->length + 1));
+	profile_code = code;
+}
+
+// Add `profile_counts` to the profile by loop.
+static void profile_end(void)
+{
+	const hgbf_code_t *const code = profile_code;
+	// Back-edges jump to the instruction after the JFZ.
+	const size_t jfz_size = code->layout == HGBF_CODE_ALIGNED ? 1 : 5;
+	for (size_t i = 0; i < code->loop_count; i++) {
+		const hgbf_code_loop_t *const loop = code->loops + i;
+		hgbf_profile_add(eval_profile, loop->number,
+			profile_counts[loop->position][0],
+			profile_counts[loop->position + jfz_size][1]);
+	}
+	// Code evaluated later covers more of the script.
+	hgbf_profile_set_script(eval_profile, code->script_hash);
+	profile_code = NULL;
+}
+
+// Evaluate code of either layout. See `eval_code()`.
+static int eval(
+	hgbf_code_t *code, size_t start, int64_t *address,
+	hgbf_istream_t *input, hgbf_ostream_t *output,
+	cells_t *cells)
+{
+	if (eval_profile) {
+		profile_begin(code);
+		return (code->layout == HGBF_CODE_ALIGNED ?
+			eval_aligned_profiling : eval_packed_profiling)(
+			code, start, address, input, output, cells);
+	}
+	if (code->layout == HGBF_CODE_ALIGNED) {
+		return (eval_counting ? eval_aligned_counting : eval_aligned_plain)(
+			code, start, address, input, output, cells);
+	}
+	return (eval_counting ? eval_packed_counting : eval_packed_plain)(
+		code, start, address, input, output, cells);
 }
 
+#ifdef HGBF_OPSTATS
+
+// Print statistics at exit.
+static void opstats_init(void)
+{
+	static bool done = false;
+	if (!done) {
+		done = true;
+		atexit(opstats_print);
+	}
+}
+
+#else // !HGBF_OPSTATS
+
+#define opstats_init() ((void)0)
+
+#endif // HGBF_OPSTATS
+
 void hgbf_memmax(size_t size)
 {
 	cells_mem_max = size;
 }
 
-int hgbf_eval(const hgbf_code_t *code, hgbf_eval_io_t io)
+void hgbf_stepmax(uint64_t steps)
+{
+	eval_steps_max = steps;
+}
+
+void hgbf_timemax(double seconds)
+{
+	eval_time_max = seconds;
+}
+
+void hgbf_eval_count(bool enable)
+{
+	eval_counting = enable;
+}
+
+void hgbf_eval_stats(hgbf_eval_stats_t *stats)
+{
+	*stats = eval_stats;
+}
+
+void hgbf_eval_profile(hgbf_profile_t *profile)
+{
+	eval_profile = profile;
+}
+
+void hgbf_eval_lanes(bool enable)
+{
+	eval_lanes = enable;
+}
+
+void hgbf_checkpoint(const char *file, size_t interval)
+{
+	checkpoint_file = file;
+	checkpoint_interval = interval;
+}
+
+void hgbf_checkpoint_request(void)
+{
+	checkpoint_requested = 1;
+}
+
+static double timespec_seconds(const struct timespec *ts)
+{
+	return (double)ts->tv_sec + (double)ts->tv_nsec / 1e9;
+}
+
+// Reset states of the current evaluation, or continue those of the run if it
+// is not NULL.
+static void eval_prepare(const eval_run_t *run)
+{
+	opstats_init();
+	eval_input_count = run ? run->input_count : 0;
+	eval_output_count = run ? run->output_count : 0;
+	eval_backedges = run ? run->backedges : 0;
+	eval_executed = 0;
+	checkpoint_backedges = 0;
+	if (eval_time_max > 0) {
+		timespec_get(&eval_start, TIME_UTC);
+		const double sec = timespec_seconds(&eval_start) +
+			eval_time_max - (run ? run->time_used : 0);
+		eval_deadline.tv_sec = (time_t)sec;
+		eval_deadline.tv_nsec = (long)((sec - (double)eval_deadline.tv_sec) * 1e9);
+	}
+}
+
+// Add states of the finished evaluation to the statistics, and to the run if
+// it is not NULL.
+static void eval_finish(eval_run_t *run)
+{
+	eval_stats.instructions += eval_executed;
+	eval_stats.backedges += eval_backedges - (run ? run->backedges : 0);
+	eval_stats.input_bytes += eval_input_count - (run ? run->input_count : 0);
+	eval_stats.output_bytes += eval_output_count - (run ? run->output_count : 0);
+	if (cells_mem_used > eval_stats.peak_mem)
+		eval_stats.peak_mem = cells_mem_used;
+	if (profile_code)
+		profile_end();
+	if (run) {
+		// Kept within the limit, so that the next evaluation fails at its first back-edge.
+		run->backedges = eval_steps_max && eval_backedges > eval_steps_max ?
+			eval_steps_max : eval_backedges;
+		run->input_count = eval_input_count;
+		run->output_count = eval_output_count;
+		if (eval_time_max > 0) {
+			struct timespec now;
+			timespec_get(&now, TIME_UTC);
+			run->time_used += timespec_seconds(&now) - timespec_seconds(&eval_start);
+		}
+	}
+}
+
+static int _hgbf_eval(hgbf_code_t *code, hgbf_eval_io_t io, const char *resume_file,
+	const char *load_file, const char *save_file)
 {
-	assert(code->bytes[code->length - 1] == (unsigned char)HGBF_OP_HLT);
 	cells_t cells;
+	tape_map_t map = {.data = NULL};
 	cells_mem_used = 0;
-	cells_init(&cells);
+	if (cells_init(&cells))
+		return -1;
+	eval_prepare(NULL);
 	int ret;
-	if (!setjmp(error_jumpbuf))
-		ret = eval(code, io.i, io.o, &cells);
+	if (!setjmp(error_jumpbuf)) {
+		size_t start = 0;
+		int64_t start_address = 0;
+		if (load_file && tape_load(load_file, &cells, &start_address, &map))
+			start = (size_t)-1;
+		if (resume_file) {
+			start = checkpoint_load(resume_file, code, &start_address, io, &cells);
+		} else if (start != (size_t)-1) {
+			// The range is relative to where the data pointer starts.
+			cells_reserve(&cells, start_address + code->tape_min,
+				start_address + code->tape_max);
+		}
+		if (start == (size_t)-1)
+			ret = -1;
+		else
+			ret = eval(code, start, &start_address, io.i, io.o, &cells);
+		if (!ret && save_file)
+			ret = tape_save(save_file, &cells, start_address);
+	}
 	else
 		ret = -1;
+	eval_finish(NULL);
 	cells_destroy(&cells);
+	tape_unmap(&map);
 	return ret;
 }
+
+int hgbf_eval(hgbf_code_t *code, hgbf_eval_io_t io)
+{
+	return _hgbf_eval(code, io, NULL, NULL, NULL);
+}
+
+int hgbf_eval_resume(hgbf_code_t *code, hgbf_eval_io_t io, const char *file)
+{
+	return _hgbf_eval(code, io, file, NULL, NULL);
+}
+
+int hgbf_eval_tape(hgbf_code_t *code, hgbf_eval_io_t io,
+	const char *load_file, const char *save_file)
+{
+	return _hgbf_eval(code, io, NULL, load_file, save_file);
+}
+
+#define TAPE_KEEP_PAGES 256 // Tapes holding more pages are freed after use.
+
+struct hgbf_tape {
+	cells_t cells;
+	size_t mem_used;
+};
+
+hgbf_tape_t *hgbf_tape_new(void)
+{
+	hgbf_tape_t *const tape = malloc(sizeof(hgbf_tape_t));
+	if (cells_init(&tape->cells)) {
+		free(tape);
+		return NULL;
+	}
+	tape->mem_used = 0;
+	return tape;
+}
+
+int hgbf_tape_eval(hgbf_tape_t *tape, hgbf_code_t *code, hgbf_eval_io_t io)
+{
+	// Cells that failed to be recreated after the last evaluation.
+	if (!tape->cells.pages && cells_init(&tape->cells))
+		return -1;
+	cells_mem_used = tape->mem_used;
+	eval_prepare(NULL);
+	int ret;
+	if (!setjmp(error_jumpbuf)) {
+		int64_t address = 0;
+		cells_reserve(&tape->cells, code->tape_min, code->tape_max);
+		ret = eval(code, 0, &address, io.i, io.o, &tape->cells);
+	} else {
+		ret = -1;
+	}
+	eval_finish(NULL);
+	if (tape->cells.page_count > TAPE_KEEP_PAGES) {
+		cells_destroy(&tape->cells);
+		cells_mem_used = 0;
+		if (cells_init(&tape->cells))
+			ret = -1;
+	} else {
+		cells_clear(&tape->cells, code->tape_min, code->tape_max);
+	}
+	tape->mem_used = cells_mem_used;
+	return ret;
+}
+
+void hgbf_tape_free(hgbf_tape_t *tape)
+{
+	cells_destroy(&tape->cells);
+	free(tape);
+}
+
+// Read a record ending with the delimiter or at the end of the stream into the
+// buffer. Return its size, or 0 at the end of the stream.
+static size_t batch_read_record(hgbf_istream_t *input, int delimiter,
+	unsigned char **buffer, size_t *capacity)
+{
+	size_t size = 0;
+	for (int c; (c = hgbf_istream_read1(input)) >= 0; ) {
+		if (size == *capacity)
+			*buffer = realloc(*buffer, (*capacity = *capacity ? *capacity * 2 : 256));
+		(*buffer)[size++] = (unsigned char)c;
+		if (c == delimiter)
+			break;
+	}
+	return size;
+}
+
+// Evaluate a record of batch mode on the tape.
+static int batch_eval_record(hgbf_tape_t *tape, hgbf_code_t *code,
+	hgbf_ostream_t *output, const unsigned char *record, size_t size, size_t number)
+{
+	const hgbf_eval_io_t record_io = {
+		.i = hgbf_istream_open_mem((const char *)record, size),
+		.o = output,
+	};
+	const int ret = hgbf_tape_eval(tape, code, record_io);
+	hgbf_istream_close(record_io.i);
+	if (ret) {
+		char message[128];
+		snprintf(message, sizeof message, "%s", hgbf_err_read());
+		hgbf_err_record("record %zu: %s", number, message);
+		return -1;
+	}
+	if (hgbf_ostream_flush(output)) {
+		hgbf_err_record("output error");
+		return -1;
+	}
+	return 0;
+}
+
+// Like `hgbf_eval_batch()`, but evaluate `HGBF_LANES` records at a time in
+// lockstep. Records that fail or whose lanes drift apart are evaluated again
+// one by one, in order, so the output is the same.
+static int batch_lanes(hgbf_code_t *code, hgbf_eval_io_t io, int delimiter)
+{
+	hgbf_lanes_t *const lanes = hgbf_lanes_new();
+	hgbf_tape_t *tape = NULL;
+	unsigned char *records[HGBF_LANES] = {NULL};
+	size_t capacities[HGBF_LANES] = {0}, sizes[HGBF_LANES];
+	size_t record_count = 0;
+	int ret = 0;
+	while (!ret) {
+		size_t count = 0;
+		while (count < HGBF_LANES &&
+				(sizes[count] = batch_read_record(io.i, delimiter, &records[count], &capacities[count])))
+			count++;
+		if (!count)
+			break;
+		const uint32_t fallback = hgbf_lanes_eval(lanes, code,
+			(const unsigned char *const *)records, sizes, count);
+		for (size_t i = 0; i < count && !ret; i++) {
+			record_count++;
+			if (fallback >> i & 1) {
+				if (!tape && !(tape = hgbf_tape_new())) {
+					ret = -1;
+					break;
+				}
+				ret = batch_eval_record(tape, code, io.o, records[i], sizes[i], record_count);
+				continue;
+			}
+			size_t output_size, input_used;
+			const unsigned char *const output =
+				hgbf_lanes_output(lanes, i, &output_size, &input_used);
+			eval_stats.input_bytes += input_used;
+			eval_stats.output_bytes += output_size;
+			if ((output_size && hgbf_ostream_write(io.o, output, output_size)) ||
+					hgbf_ostream_flush(io.o)) {
+				hgbf_err_record("output error");
+				ret = -1;
+			}
+		}
+	}
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		free(records[i]);
+	if (tape)
+		hgbf_tape_free(tape);
+	hgbf_lanes_free(lanes);
+	return ret;
+}
+
+int hgbf_eval_batch(hgbf_code_t *code, hgbf_eval_io_t io, int delimiter)
+{
+	// The lockstep evaluator does not poll, profile or limit memory.
+	if (eval_lanes && code->layout == HGBF_CODE_PACKED && !eval_profile &&
+			!cells_mem_max && !eval_steps_max && !(eval_time_max > 0) && !checkpoint_file)
+		return batch_lanes(code, io, delimiter);
+
+	hgbf_tape_t *const tape = hgbf_tape_new();
+	if (!tape)
+		return -1;
+	unsigned char *record = NULL;
+	size_t record_capacity = 0, record_count = 0;
+	int ret = 0;
+	for (size_t size; !ret &&
+			(size = batch_read_record(io.i, delimiter, &record, &record_capacity)); )
+		ret = batch_eval_record(tape, code, io.o, record, size, ++record_count);
+	free(record);
+	hgbf_tape_free(tape);
+	return ret;
+}
+
+struct hgbf_session {
+	cells_t cells;
+	int64_t address; // Data pointer.
+	size_t mem_used;
+	eval_run_t run;
+	hgbf_eval_io_t io;
+};
+
+hgbf_session_t *hgbf_session_new(hgbf_eval_io_t io)
+{
+	hgbf_session_t *const session = malloc(sizeof(hgbf_session_t));
+	if (cells_init(&session->cells)) {
+		free(session);
+		return NULL;
+	}
+	session->address = 0;
+	session->mem_used = 0;
+	memset(&session->run, 0, sizeof session->run);
+	session->io = io;
+	return session;
+}
+
+int hgbf_session_eval(hgbf_session_t *session, hgbf_code_t *code)
+{
+	cells_mem_used = session->mem_used;
+	eval_prepare(&session->run);
+	int64_t address = session->address;
+	int ret;
+	if (!setjmp(error_jumpbuf))
+		ret = eval(code, 0, &address, session->io.i, session->io.o, &session->cells);
+	else
+		ret = -1;
+	if (!ret)
+		session->address = address;
+	session->mem_used = cells_mem_used;
+	eval_finish(&session->run);
+	return ret;
+}
+
+void hgbf_session_free(hgbf_session_t *session)
+{
+	cells_destroy(&session->cells);
+	free(session);
+}
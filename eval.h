@@ -1,8 +1,11 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct hgbf_code hgbf_code_t;
+typedef struct hgbf_profile hgbf_profile_t;
 typedef struct _hgbf_istream hgbf_istream_t;
 typedef struct _hgbf_ostream hgbf_ostream_t;
 
@@ -15,5 +18,96 @@ typedef struct {
 // Set cells memory limitation.
 void hgbf_memmax(size_t size);
 
+// Set maximum number of loop iterations. 0 means no limitation.
+void hgbf_stepmax(uint64_t steps);
+
+// Set maximum wall-clock time of an evaluation in seconds. 0 means no limitation.
+void hgbf_timemax(double seconds);
+
+// Statistics accumulated over evaluations.
+typedef struct {
+	uint64_t instructions; // Executed instructions; counted only if enabled.
+	uint64_t backedges; // Loop back-edges taken.
+	uint64_t input_bytes, output_bytes;
+	size_t peak_mem; // Maximum cells memory size in bytes.
+} hgbf_eval_stats_t;
+
+// Enable or disable counting of executed instructions. Evaluation is a little
+// slower when enabled.
+void hgbf_eval_count(bool enable);
+
+// Get statistics of the evaluations so far.
+void hgbf_eval_stats(hgbf_eval_stats_t *stats);
+
+// Record loop counts of evaluations afterwards to the profile, or stop
+// recording if it is NULL. Evaluation is slower while recording.
+void hgbf_eval_profile(hgbf_profile_t *profile);
+
+// Set checkpoint file. Checkpoints are written when requested with
+// `hgbf_checkpoint_request()`, and every `interval` loop iterations if it is not 0.
+void hgbf_checkpoint(const char *file, size_t interval);
+
+// Request a checkpoint as soon as possible. Safe to call in signal handlers.
+void hgbf_checkpoint_request(void);
+
 // Evaluate code. On success, return 0; on failure, return -1 and record error message.
-int hgbf_eval(const hgbf_code_t *code, hgbf_eval_io_t io);
+// The code is not changed unless it is tiered, whose loops are updated as they
+// get hot (see `hgbf_code_tiered()`).
+int hgbf_eval(hgbf_code_t *code, hgbf_eval_io_t io);
+
+// Like `hgbf_eval()`, but continue from a checkpoint file. The streams are
+// moved past the data consumed and produced before the checkpoint.
+int hgbf_eval_resume(hgbf_code_t *code, hgbf_eval_io_t io, const char *file);
+
+// Like `hgbf_eval()`, but start with the cells and data pointer stored in tape
+// file `load_file` if it is not NULL, and store the final ones to tape file
+// `save_file` if it is not NULL and the evaluation succeeds. The loaded file
+// is mapped privately into memory where supported and its cells are used in
+// place; it is not changed even if both files are the same, until the saved
+// one replaces it. The code must not assume the cells to be zero at the start or
+// unused after the end if the files are given; see `hgbf_code_cells()`.
+int hgbf_eval_tape(hgbf_code_t *code, hgbf_eval_io_t io,
+	const char *load_file, const char *save_file);
+
+// Reusable cells for independent evaluations.
+typedef struct hgbf_tape hgbf_tape_t;
+
+// Create a tape with all cells being zero. Return NULL and record error
+// message if out of memory.
+hgbf_tape_t *hgbf_tape_new(void);
+
+// Evaluate code on the tape from the first cell, then zero the cells that the
+// code may have written, keeping their memory for the next evaluation. Return
+// like `hgbf_eval()`.
+int hgbf_tape_eval(hgbf_tape_t *tape, hgbf_code_t *code, hgbf_eval_io_t io);
+
+// Free the tape.
+void hgbf_tape_free(hgbf_tape_t *tape);
+
+// Evaluate code once per record of the input stream. A record ends with the
+// `delimiter` byte, which it includes, or at the end of the stream. Each
+// evaluation starts with all cells being zero, reads from its record only, and
+// has its output flushed. On success, return 0; on failure, stop, return -1
+// and record error message.
+int hgbf_eval_batch(hgbf_code_t *code, hgbf_eval_io_t io, int delimiter);
+
+// Evaluate batch records afterwards in lockstep on SIMD lanes, several at a
+// time, which is faster for short programs that branch alike on most records.
+// Not done while evaluations are limited, profiled or checkpointed, and
+// instructions evaluated in lockstep are not counted.
+void hgbf_eval_lanes(bool enable);
+
+// Evaluation session, which keeps cells and data pointer between evaluations.
+// Step and time limits apply to all evaluations of a session together.
+typedef struct hgbf_session hgbf_session_t;
+
+// Create a session with all cells being zero. Return NULL and record error
+// message if out of memory.
+hgbf_session_t *hgbf_session_new(hgbf_eval_io_t io);
+
+// Evaluate code in the session. On success, return 0; on failure, return -1
+// and record error message, and the data pointer is not moved.
+int hgbf_session_eval(hgbf_session_t *session, hgbf_code_t *code);
+
+// Free the session.
+void hgbf_session_free(hgbf_session_t *session);
@@ -1,3 +1,4 @@
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -16,6 +17,10 @@
 #include "error.h"
 #include "eval.h"
 #include "getopt.h"
+#include "perf.h"
+#include "profile.h"
+#include "server.h"
+#include "stats.h"
 #include "stream.h"
 
 typedef struct {
@@ -24,17 +29,45 @@ typedef struct {
 	const char *script_string;
 	const char *istream_file;
 	const char *ostream_file;
+	const char *checkpoint_file;
+	const char *resume_file;
+	const char *stats_file;
+	const char *server_socket;
+	const char *profile_record_file;
+	const char *profile_use_file;
+	const char *tape_load_file;
+	const char *tape_save_file;
+	size_t checkpoint_interval;
+	size_t parse_threads;
+	int batch_delimiter; // Record delimiter in batch mode; -1 if not in batch mode.
 	size_t memory_limit;
+	size_t step_limit;
+	size_t tier_threshold;
+	double time_limit;
 	bool interactive;
+	bool streaming;
 	bool dump_code;
 	bool do_not_run;
+	bool aligned_code;
+	bool batch_lanes;
+	bool async_output;
+	bool perf;
 } argparse_res_t;
 
 static void init(void);
+static void on_checkpoint_signal(int sig);
 static argparse_res_t parse_args(int argc, char *argv[]);
 static void interactive(const argparse_res_t *args, hgbf_eval_io_t eval_io);
 static int run_script(const argparse_res_t *args,
 	hgbf_istream_t *script, hgbf_eval_io_t eval_io);
+static int run_script_streaming(const argparse_res_t *args,
+	hgbf_istream_t *script, hgbf_eval_io_t eval_io);
+static int run_code(const argparse_res_t *args,
+	hgbf_code_t *code, hgbf_session_t *session, hgbf_eval_io_t eval_io);
+static void report_error(const argparse_res_t *args, const char *kind);
+
+static hgbf_perf_t *perf; // Measurement of evaluations, if requested.
+static hgbf_stats_t *stats; // Statistics to write at exit, if requested.
 
 int main(int argc, char *argv[])
 {
@@ -44,13 +77,63 @@ int main(int argc, char *argv[])
 
 	const argparse_res_t args = parse_args(argc, argv);
 
+	if (args.aligned_code)
+		hgbf_code_layout(HGBF_CODE_ALIGNED);
+	if (args.parse_threads)
+		hgbf_code_threads(args.parse_threads);
+	if (args.tier_threshold && !args.interactive && !args.streaming &&
+			!args.profile_record_file && !args.batch_lanes &&
+			!args.checkpoint_file && !args.resume_file)
+		hgbf_code_tiered((uint32_t)args.tier_threshold);
+	if (args.tape_load_file || args.tape_save_file)
+		hgbf_code_cells(!args.tape_load_file, args.tape_save_file);
+	hgbf_profile_t *profile_use = NULL, *profile_record = NULL;
+	if (args.profile_use_file) {
+		profile_use = hgbf_profile_load(args.profile_use_file);
+		if (!profile_use) {
+			fprintf(stderr, "%s: %s\n", args.program, hgbf_err_read());
+			return EXIT_FAILURE;
+		}
+		hgbf_code_profile(profile_use);
+	}
+	if (args.profile_record_file) {
+		profile_record = hgbf_profile_new();
+		hgbf_eval_profile(profile_record);
+	}
+	if (args.batch_lanes)
+		hgbf_eval_lanes(true);
 	if (args.memory_limit)
 		hgbf_memmax(args.memory_limit);
+	if (args.step_limit)
+		hgbf_stepmax(args.step_limit);
+	if (args.time_limit > 0)
+		hgbf_timemax(args.time_limit);
+	if (args.perf) {
+		hgbf_eval_count(true);
+		perf = hgbf_perf_new();
+	}
+	if (args.stats_file) {
+		// Instructions are counted for -p only, as counting slows evaluation.
+		stats = calloc(1, sizeof *stats);
+		stats->counted = args.perf;
+	}
+	if (args.checkpoint_file) {
+		hgbf_checkpoint(args.checkpoint_file, args.checkpoint_interval);
+#ifdef SIGUSR1
+		signal(SIGUSR1, on_checkpoint_signal);
+#endif // SIGUSR1
+	}
 
+	// Output written by a thread, where reading stdin flushes it before waiting.
+	hgbf_ostream_t *const async_output = args.async_output && !args.interactive &&
+		!args.server_socket && !args.checkpoint_file && !args.resume_file ?
+			hgbf_ostream_open_async(args.ostream_file) : NULL;
+	const bool script_stdin = args.script_file && !strcmp(args.script_file, "-");
 	const hgbf_eval_io_t eval_io = {
-		.i = !args.istream_file ? hgbf_stdin() :
-			hgbf_istream_open_file(args.istream_file),
-		.o = !args.ostream_file ? hgbf_stdout() :
+		.i = args.istream_file ? hgbf_istream_open_file(args.istream_file) :
+			async_output && !script_stdin ? hgbf_stdin_tied(async_output) : hgbf_stdin(),
+		.o = async_output ? async_output : !args.ostream_file ? hgbf_stdout() :
+			args.resume_file ? hgbf_ostream_reopen_file(args.ostream_file) :
 			hgbf_ostream_open_file(args.ostream_file),
 	};
 	if (!eval_io.i) {
@@ -64,27 +147,58 @@ int main(int argc, char *argv[])
 		goto bad_ostream;
 	}
 
-	if (args.interactive) {
+	if (args.server_socket) {
+		hgbf_serve(args.server_socket);
+		fprintf(stderr, "%s: server error: %s\n", args.program, hgbf_err_read());
+		exit_status = EXIT_FAILURE;
+	} else if (args.interactive) {
 		interactive(&args, eval_io);
 		exit_status = EXIT_SUCCESS;
 	} else {
 		hgbf_istream_t *const script =
 			args.script_file ? !strcmp(args.script_file, "-") ?
-				hgbf_stdin() : hgbf_istream_open_file(args.script_file) :
+				hgbf_stdin() : hgbf_istream_map_file(args.script_file) :
 				hgbf_istream_open_mem(args.script_string, strlen(args.script_string));
 		if (!script) {
 			fprintf(stderr, "%s: failed to read the script\n", args.program);
 			exit_status = EXIT_FAILURE;
 		} else {
-			exit_status = run_script(&args, script, eval_io);
+			exit_status = args.streaming ?
+				run_script_streaming(&args, script, eval_io) :
+				run_script(&args, script, eval_io);
 			hgbf_istream_close(script);
 		}
 	}
 
-	if (args.ostream_file)
+	if (perf) {
+		hgbf_eval_stats_t stats;
+		hgbf_eval_stats(&stats);
+		hgbf_perf_report(perf, &stats, stderr);
+		hgbf_perf_free(perf);
+	}
+	if (stats) {
+		hgbf_eval_stats(&stats->eval);
+		FILE *const fp = fopen(args.stats_file, "w");
+		if (fp) {
+			hgbf_stats_write_json(stats, fp);
+			fclose(fp);
+		} else {
+			fprintf(stderr, "%s: failed to write statistics\n", args.program);
+		}
+		free(stats);
+	}
+	if (profile_record) {
+		if (hgbf_profile_save(profile_record, args.profile_record_file))
+			fprintf(stderr, "%s: %s\n", args.program, hgbf_err_read());
+		hgbf_profile_free(profile_record);
+	}
+	if (profile_use)
+		hgbf_profile_free(profile_use);
+
+	if (args.ostream_file || async_output)
 		hgbf_ostream_close(eval_io.o);
 bad_ostream:
-	if (args.istream_file)
+	if (eval_io.i != hgbf_stdin())
 		hgbf_istream_close(eval_io.i);
 bad_istream:
 
@@ -111,6 +225,12 @@ static void init(void)
 #endif // _WIN32
 }
 
+static void on_checkpoint_signal(int sig)
+{
+	(void)sig;
+	hgbf_checkpoint_request();
+}
+
 static size_t parse_num_with_suffix(const char *s)
 {
 	char *endptr;
@@ -140,11 +260,30 @@ static const hgbf_optdef_t optdefs[] = {
 	{'e', "SCRIPT", "execute the SCRIPT string"},
 	{'f', "FILE", "execute code from FILE"},
 	{'i', NULL, "enter interactive mode"},
+	{'L', "SOCKET", "serve requests on the Unix domain SOCKET"},
+	{'s', NULL, "compile and execute the script piece by piece as it is read"},
 	{'d', NULL, "dump instructions"},
 	{'c', NULL, "compile but do not execute"},
+	{'A', NULL, "generate fixed-width aligned instructions"},
+	{'P', "COUNT", "parse large scripts with COUNT threads"},
+	{'g', "FILE", "record a loop profile of the evaluation to FILE"},
+	{'u', "FILE", "optimize code for the loop profile in FILE"},
+	{'k', "COUNT[K|M|G]", "optimize loops once they iterate COUNT times (not with -i, -s, -g, -W, -C or -R)"},
+	{'p', NULL, "report performance counters of the evaluation"},
+	{'j', "FILE", "write statistics of the run to FILE as JSON at exit (instructions with -p)"},
 	{'I', "FILE", "use the FILE instead of stdin as input stream"},
+	{'b', "BYTE", "run once per input record ending with BYTE (its code, or a non-digit character)"},
+	{'W', NULL, "run batch records in lockstep on SIMD lanes"},
+	{'t', "FILE", "start with the cells and data pointer in tape FILE"},
+	{'w', "FILE", "store the final cells and data pointer to tape FILE"},
 	{'O', "FILE", "use the FILE instead of stdout as output stream"},
-	{'M', "SIZE[K|M|G][i]", "maximum cells (runtime memory) size"},
+	{'a', NULL, "write output from a separate thread (not with -i, -L, -C or -R)"},
+	{'M', "SIZE[K|M|G][i]", "maximum cells (runtime memory) size, used in whole 4 KiB pages"},
+	{'S', "COUNT[K|M|G]", "maximum loop iterations (steps)"},
+	{'T', "SECONDS", "maximum evaluation wall-clock time"},
+	{'C', "FILE", "write checkpoints to FILE (on SIGUSR1)"},
+	{'N', "COUNT[K|M|G]", "also checkpoint every COUNT loop iterations"},
+	{'R', "FILE", "resume from checkpoint FILE"},
 	{0, NULL, NULL},
 };
 #pragma pack(pop)
@@ -216,6 +355,14 @@ static void getopt_handler(
 		res->interactive = true;
 		break;
 
+	case 'L':
+		res->server_socket = arg;
+		break;
+
+	case 's':
+		res->streaming = true;
+		break;
+
 	case 'd':
 		res->dump_code = true;
 		break;
@@ -224,10 +371,82 @@ static void getopt_handler(
 		res->do_not_run = true;
 		break;
 
+	case 'A':
+		res->aligned_code = true;
+		break;
+
+	case 'p':
+		res->perf = true;
+		break;
+
+	case 'g':
+		res->profile_record_file = arg;
+		break;
+
+	case 'u':
+		res->profile_use_file = arg;
+		break;
+
+	case 'j':
+		res->stats_file = arg;
+		break;
+
+	case 'k':
+		res->tier_threshold = parse_num_with_suffix(arg);
+		if (res->tier_threshold == (size_t)-1 || res->tier_threshold > UINT32_MAX) {
+			fprintf(stderr, "%s: illegal count: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+
+	case 'P':
+		res->parse_threads = parse_num_with_suffix(arg);
+		if (res->parse_threads == (size_t)-1) {
+			fprintf(stderr, "%s: illegal count: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+
+	case 'b':
+	{
+		// A number is a code, so digits are given by their codes.
+		char *endptr;
+		long code = strtol(arg, &endptr, 10);
+		if (endptr == arg && arg[0] && !arg[1])
+			code = (unsigned char)arg[0];
+		else if (endptr == arg || *endptr)
+			code = -1;
+		if (code < 0 || code > 255) {
+			fprintf(stderr, "%s: illegal byte: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+		res->batch_delimiter = (int)code;
+	}
+		break;
+
+	case 'W':
+		res->batch_lanes = true;
+		break;
+
+	case 't':
+		res->tape_load_file = arg;
+		break;
+
+	case 'w':
+		res->tape_save_file = arg;
+		break;
+
 	case 'I':
 		res->istream_file = arg;
 		break;
 
+	case 'a':
+		res->async_output = true;
+		break;
+
 	case 'O':
 		res->ostream_file = arg;
 		break;
@@ -241,6 +460,44 @@ static void getopt_handler(
 		}
 		break;
 
+	case 'S':
+		res->step_limit = parse_num_with_suffix(arg);
+		if (res->step_limit == (size_t)-1) {
+			fprintf(stderr, "%s: illegal count: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+
+	case 'T':
+	{
+		char *endptr;
+		res->time_limit = strtod(arg, &endptr);
+		if (endptr == arg || *endptr || !(res->time_limit > 0)) {
+			fprintf(stderr, "%s: illegal time: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+	}
+		break;
+
+	case 'C':
+		res->checkpoint_file = arg;
+		break;
+
+	case 'N':
+		res->checkpoint_interval = parse_num_with_suffix(arg);
+		if (res->checkpoint_interval == (size_t)-1) {
+			fprintf(stderr, "%s: illegal count: `%s'\n",
+				res->program, arg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+
+	case 'R':
+		res->resume_file = arg;
+		break;
+
 	default:
 		break;
 	}
@@ -263,13 +520,20 @@ static argparse_res_t parse_args(int argc, char *argv[])
 		.script_string = NULL,
 		.istream_file = NULL,
 		.ostream_file = NULL,
+		.checkpoint_file = NULL,
+		.resume_file = NULL,
+		.checkpoint_interval = 0,
 		.memory_limit = 0,
+		.step_limit = 0,
+		.time_limit = 0,
 		.interactive = false,
+		.streaming = false,
 		.dump_code = false,
 		.do_not_run = false,
+		.batch_delimiter = -1,
 	};
 	hgbf_getopt(optdefs, getopt_handler, argc, argv, &res);
-	if (!(res.script_file || res.script_string || res.interactive)) {
+	if (!(res.script_file || res.script_string || res.interactive || res.server_socket)) {
 		if (stdin_is_tty())
 			res.interactive = true;
 		else
@@ -280,12 +544,19 @@ static argparse_res_t parse_args(int argc, char *argv[])
 
 static void interactive(const argparse_res_t *args, hgbf_eval_io_t eval_io)
 {
+	hgbf_session_t *const session = hgbf_session_new(eval_io);
+	if (!session) {
+		report_error(args, "runtime");
+		return;
+	}
 	size_t buffer_size = 128;
 	char *buffer = malloc(buffer_size);
-	const char *const prompt = "BF> ";
+	const char *const prompt = "BF> ", *const prompt_more = "... ";
+	hgbf_compiler_t *const compiler = hgbf_compiler_new();
+	bool more = false;
 
 	while (true) {
-		fputs(prompt, stdout);
+		fputs(more ? prompt_more : prompt, stdout);
 		fflush(stdout);
 
 		char *buffer_p = buffer;
@@ -311,32 +582,116 @@ static void interactive(const argparse_res_t *args, hgbf_eval_io_t eval_io)
 
 		hgbf_istream_t *const script =
 			hgbf_istream_open_mem(buffer, buffer_p - buffer);
-		run_script(args, script, eval_io);
+		hgbf_code_t *code;
+		const double compile_start = stats ? hgbf_stats_clock() : 0.0;
+		const int compile_err = hgbf_compiler_feed(compiler, script, &code);
+		if (stats)
+			stats->compile_time += hgbf_stats_clock() - compile_start;
+		if (compile_err) {
+			report_error(args, "syntax");
+			more = false;
+		} else {
+			more = !code;
+			if (code)
+				run_code(args, code, session, eval_io);
+		}
 		hgbf_istream_close(script);
 	}
 
 quit:
+	hgbf_session_free(session);
+	hgbf_compiler_free(compiler);
 	free(buffer);
 }
 
 static int run_script(const argparse_res_t *args,
 	hgbf_istream_t *script, hgbf_eval_io_t eval_io)
 {
+	const double compile_start = stats ? hgbf_stats_clock() : 0.0;
 	hgbf_code_t *const code = hgbf_code_compile(script);
+	if (stats)
+		stats->compile_time += hgbf_stats_clock() - compile_start;
 	if (!code) {
-		fprintf(stderr, "%s: syntax error: %s\n", args->program, hgbf_err_read());
+		report_error(args, "syntax");
+		return EXIT_FAILURE;
+	}
+	return run_code(args, code, NULL, eval_io);
+}
+
+static int run_script_streaming(const argparse_res_t *args,
+	hgbf_istream_t *script, hgbf_eval_io_t eval_io)
+{
+	hgbf_session_t *const session = hgbf_session_new(eval_io);
+	if (!session) {
+		report_error(args, "runtime");
 		return EXIT_FAILURE;
 	}
+	hgbf_compiler_t *const compiler = hgbf_compiler_new();
+	int status = EXIT_SUCCESS;
+	while (status == EXIT_SUCCESS) {
+		hgbf_code_t *code;
+		const double compile_start = stats ? hgbf_stats_clock() : 0.0;
+		const int compile_err = hgbf_compiler_next(compiler, script, &code);
+		if (stats)
+			stats->compile_time += hgbf_stats_clock() - compile_start;
+		if (compile_err) {
+			report_error(args, "syntax");
+			status = EXIT_FAILURE;
+		} else if (!code) {
+			break;
+		} else {
+			status = run_code(args, code, session, eval_io);
+		}
+	}
+	hgbf_session_free(session);
+	hgbf_compiler_free(compiler);
+	return status;
+}
+
+// Dump and evaluate the code, in the session if it is not NULL. Free the code.
+static int run_code(const argparse_res_t *args,
+	hgbf_code_t *code, hgbf_session_t *session, hgbf_eval_io_t eval_io)
+{
 	if (args->dump_code) {
 		puts("------------");
 		hgbf_code_dump(code);
 		puts("------------");
+		fflush(stdout); // The output stream may not go through stdio.
+	}
+	if (args->do_not_run) {
+		hgbf_code_free(code);
+		return EXIT_SUCCESS;
 	}
-	const int eval_err = args->do_not_run ? EXIT_SUCCESS : hgbf_eval(code, eval_io);
+	if (stats)
+		stats->code_size += code->length;
+	const double eval_start = stats ? hgbf_stats_clock() : 0.0;
+	if (perf)
+		hgbf_perf_start(perf);
+	const int eval_err =
+		session ? hgbf_session_eval(session, code) :
+		args->resume_file ? hgbf_eval_resume(code, eval_io, args->resume_file) :
+		args->batch_delimiter >= 0 ? hgbf_eval_batch(code, eval_io, args->batch_delimiter) :
+		args->tape_load_file || args->tape_save_file ?
+			hgbf_eval_tape(code, eval_io, args->tape_load_file, args->tape_save_file) :
+		hgbf_eval(code, eval_io);
+	if (perf)
+		hgbf_perf_stop(perf);
+	if (stats)
+		stats->eval_time += hgbf_stats_clock() - eval_start;
 	hgbf_code_free(code);
 	if (eval_err) {
-		fprintf(stderr, "%s: runtime error: %s\n", args->program, hgbf_err_read());
+		report_error(args, "runtime");
 		return EXIT_FAILURE;
 	}
 	return EXIT_SUCCESS;
 }
+
+// Print the last recorded error, and keep it for the statistics.
+static void report_error(const argparse_res_t *args, const char *kind)
+{
+	fprintf(stderr, "%s: %s error: %s\n", args->program, kind, hgbf_err_read());
+	if (stats) {
+		stats->error_kind = kind;
+		snprintf(stats->error, sizeof stats->error, "%s", hgbf_err_read());
+	}
+}
@@ -0,0 +1,581 @@
+#include "lanes.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "opcode.h"
+
+#if (defined __SSE2__ || defined _M_X64) && HGBF_LANES == 16
+#	include <emmintrin.h>
+#	define LANES_SSE2
+#endif // __SSE2__
+
+#define LANES_ROWS_MIN 256 // Initial number of rows.
+#define LANES_ROWS_MAX 0x100000 // Lanes needing more rows fall back.
+#define LANES_SLICE 0x10000 // Backward jumps before parked lanes may run.
+
+typedef uint32_t lane_mask_t; // Bit i stands for lane i.
+
+// One cell of each lane.
+typedef unsigned char lanes_row_t[HGBF_LANES];
+
+struct lane {
+	const unsigned char *input;
+	size_t input_size, input_used;
+	unsigned char *output;
+	size_t output_size, output_capacity;
+	const unsigned char *cp; // Where the lane continues if it is parked.
+	int64_t address; // Data pointer of the lane if it is parked.
+};
+
+struct hgbf_lanes {
+	struct lane lanes[HGBF_LANES];
+	lanes_row_t *rows; // Cell at address `a' of lane i is `rows[a - rows_min][i]'.
+	int64_t rows_min;
+	size_t row_count;
+};
+
+hgbf_lanes_t *hgbf_lanes_new(void)
+{
+	hgbf_lanes_t *const lanes = calloc(1, sizeof *lanes);
+	lanes->row_count = LANES_ROWS_MIN;
+	lanes->rows = calloc(lanes->row_count, sizeof(lanes_row_t));
+	lanes->rows_min = 0;
+	return lanes;
+}
+
+void hgbf_lanes_free(hgbf_lanes_t *lanes)
+{
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		free(lanes->lanes[i].output);
+	free(lanes->rows);
+	free(lanes);
+}
+
+const unsigned char *hgbf_lanes_output(const hgbf_lanes_t *lanes,
+	size_t lane, size_t *size, size_t *input_used)
+{
+	assert(lane < HGBF_LANES);
+	*size = lanes->lanes[lane].output_size;
+	*input_used = lanes->lanes[lane].input_used;
+	return lanes->lanes[lane].output;
+}
+
+// Make the rows cover addresses [min, max], keeping their cells. Return false
+// if that would take too many rows.
+static bool lanes_reserve(hgbf_lanes_t *lanes, int64_t min, int64_t max)
+{
+	const int64_t rows_max = lanes->rows_min + (int64_t)lanes->row_count - 1;
+	if (min >= lanes->rows_min && max <= rows_max)
+		return true;
+	const int64_t span_min = min < lanes->rows_min ? min : lanes->rows_min;
+	const int64_t span_max = max > rows_max ? max : rows_max;
+	size_t count = lanes->row_count;
+	while ((int64_t)count < span_max - span_min + 1) {
+		count *= 2;
+		if (count > LANES_ROWS_MAX)
+			return false;
+	}
+	// Put the extra rows on the side that grows, or split them if both do.
+	const int64_t extra = (int64_t)count - (span_max - span_min + 1);
+	const int64_t new_min =
+		max <= rows_max ? span_min - extra :
+		min >= lanes->rows_min ? span_min : span_min - extra / 2;
+
+	lanes_row_t *const rows = calloc(count, sizeof(lanes_row_t));
+	if (!rows)
+		return false;
+	memcpy(rows + (lanes->rows_min - new_min), lanes->rows,
+		lanes->row_count * sizeof(lanes_row_t));
+	free(lanes->rows);
+	lanes->rows = rows;
+	lanes->rows_min = new_min;
+	lanes->row_count = count;
+	return true;
+}
+
+// Like `lanes_reserve()`, but with addresses relative to row index `*row`,
+// which is updated for the new rows.
+static bool lanes_reserve_at(hgbf_lanes_t *lanes, int64_t *row, int64_t min, int64_t max)
+{
+	const int64_t address = *row + lanes->rows_min;
+	const bool ok = lanes_reserve(lanes, address + min, address + max);
+	*row = address - lanes->rows_min;
+	return ok;
+}
+
+// Expand lane mask bits to bytes of all ones or zeros.
+static inline void lanes_mask_bytes(lane_mask_t group, lanes_row_t mask)
+{
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		mask[i] = (group >> i & 1) ? 0xff : 0x00;
+}
+
+// Add `n` to the cells of the masked lanes.
+static inline void lanes_row_add(lanes_row_t row, const lanes_row_t mask, unsigned char n)
+{
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		row[i] = (unsigned char)(row[i] + (n & mask[i]));
+}
+
+// Set the cells of the masked lanes to `value`.
+static inline void lanes_row_set(lanes_row_t row, const lanes_row_t mask, unsigned char value)
+{
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		row[i] = (unsigned char)((row[i] & ~mask[i]) | (value & mask[i]));
+}
+
+// Get the mask of lanes whose cells are nonzero.
+static inline lane_mask_t lanes_row_nonzero(const lanes_row_t row)
+{
+#ifdef LANES_SSE2
+	const __m128i zeros = _mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i *)row), _mm_setzero_si128());
+	return (lane_mask_t)~_mm_movemask_epi8(zeros) & 0xffff;
+#else // !LANES_SSE2
+	lane_mask_t result = 0;
+	for (size_t i = 0; i < HGBF_LANES; i++)
+		result |= (lane_mask_t)(row[i] != 0) << i;
+	return result;
+#endif // LANES_SSE2
+}
+
+// Run the linear loop at row index `*row` in closed form with SOLVE terms on
+// each lane of `group`, reserving the rows. Return false if they are too many.
+static bool lanes_solve(hgbf_lanes_t *lanes, int64_t *row, lane_mask_t group,
+	unsigned char step, const unsigned char *terms, size_t size)
+{
+	int64_t min = 0, max = 0;
+	for (size_t k = 0; k < size; k += HGBF_SOLVE_TERM_SIZE) {
+		for (size_t j = 0; j < 8; j += 4) {
+			int32_t offset;
+			memcpy(&offset, terms + k + j, 4);
+			if (offset < min)
+				min = offset;
+			else if (offset > max)
+				max = offset;
+		}
+	}
+	if ((*row + min < 0 || *row + max >= (int64_t)lanes->row_count) &&
+			!lanes_reserve_at(lanes, row, min, max))
+		return false;
+
+	lanes_row_t *const rows = lanes->rows + *row;
+	for (size_t i = 0; i < HGBF_LANES; i++) {
+		const int trips = (group >> i & 1) ? hgbf_trip_count(rows[0][i], step) : 0;
+		if (trips <= 0)
+			continue;
+		for (size_t k = 0; k < size; k += HGBF_SOLVE_TERM_SIZE) {
+			int32_t target, source;
+			memcpy(&target, terms + k, 4);
+			memcpy(&source, terms + k + 4, 4);
+			unsigned int amount = (unsigned int)trips * terms[k + 8];
+			if (source)
+				amount *= rows[source][i];
+			rows[target][i] = (unsigned char)(rows[target][i] + amount);
+		}
+		rows[0][i] = 0;
+	}
+	return true;
+}
+
+// Append data to the output of a lane.
+static void lane_write(struct lane *lane, const unsigned char *data, size_t size)
+{
+	if (lane->output_size + size > lane->output_capacity) {
+		size_t capacity = lane->output_capacity ? lane->output_capacity : 64;
+		while (capacity < lane->output_size + size)
+			capacity *= 2;
+		lane->output = realloc(lane->output, capacity);
+		lane->output_capacity = capacity;
+	}
+	memcpy(lane->output + lane->output_size, data, size);
+	lane->output_size += size;
+}
+
+// Park the lanes at code position `cp` with data pointer `address`.
+static void lanes_park(hgbf_lanes_t *lanes, lane_mask_t group,
+	const unsigned char *cp, int64_t address)
+{
+	for (size_t i = 0; i < HGBF_LANES; i++) {
+		if (group >> i & 1) {
+			lanes->lanes[i].cp = cp;
+			lanes->lanes[i].address = address;
+		}
+	}
+}
+
+// Get the parked lanes at code position `cp` with data pointer `address`.
+static lane_mask_t lanes_parked_at(const hgbf_lanes_t *lanes, lane_mask_t parked,
+	const unsigned char *cp, int64_t address)
+{
+	lane_mask_t result = 0;
+	for (size_t i = 0; i < HGBF_LANES; i++) {
+		if ((parked >> i & 1) && lanes->lanes[i].cp == cp && lanes->lanes[i].address == address)
+			result |= (lane_mask_t)1 << i;
+	}
+	return result;
+}
+
+// Get the lowest code position of parked lanes that is above `after` (any
+// position if it is NULL), or `none` if there is no such lane.
+static const unsigned char *lanes_parked_next(const hgbf_lanes_t *lanes,
+	lane_mask_t parked, const unsigned char *after, const unsigned char *none)
+{
+	const unsigned char *result = none;
+	for (size_t i = 0; i < HGBF_LANES; i++) {
+		const unsigned char *const cp = lanes->lanes[i].cp;
+		if ((parked >> i & 1) && (!after || cp > after) && cp < result)
+			result = cp;
+	}
+	return result;
+}
+
+// Lanes run in groups that share a code position and a data pointer. Lanes
+// split at branches; those going to the higher position are parked, and join
+// the running group again when it reaches them. If the running group jumps
+// past parked lanes, the lowest ones run first, so that loops finish before
+// the code after them is run.
+uint32_t hgbf_lanes_eval(hgbf_lanes_t *lanes, const hgbf_code_t *code,
+	const unsigned char *const inputs[], const size_t input_sizes[], size_t count)
+{
+	assert(count <= HGBF_LANES);
+	assert(code->layout == HGBF_CODE_PACKED);
+
+	for (size_t i = 0; i < count; i++) {
+		struct lane *const lane = lanes->lanes + i;
+		lane->input = inputs[i];
+		lane->input_size = input_sizes[i];
+		lane->input_used = 0;
+		lane->output_size = 0;
+	}
+	lane_mask_t group = (lane_mask_t)(((uint64_t)1 << count) - 1); // Running lanes.
+	lane_mask_t parked = 0, failed = 0;
+	if (code->tape_min <= code->tape_max && !lanes_reserve(lanes, code->tape_min, code->tape_max))
+		return group;
+
+	const unsigned char *const code_end = code->bytes + code->length;
+	const unsigned char *cp = code->bytes; // Code pointer.
+	const unsigned char *parked_next = code_end; // Lowest position of parked lanes above `cp`.
+	int64_t row = -lanes->rows_min; // Row index of the data pointer.
+	lanes_row_t mask; // Bytes of `group`.
+	lanes_mask_bytes(group, mask);
+	size_t slice_countdown = LANES_SLICE;
+	bool rotating = false; // Whether to run the first parked lane next.
+
+	// Move the data pointer, reserving rows if needed.
+#define LANES_MOVE(N) \
+	do { \
+		row += (N); \
+		if ((uint64_t)row >= lanes->row_count && !lanes_reserve_at(lanes, &row, 0, 0)) \
+			goto drop; \
+	} while (0)
+
+	// Jump to `TARGET` with lanes of `TAKEN` and go on with the others. Whichever
+	// goes to the higher position is parked.
+#define LANES_BRANCH(TAKEN, TARGET) \
+	do { \
+		const lane_mask_t taken_ = (TAKEN) & group; \
+		const unsigned char *const target_ = (TARGET); \
+		if (taken_ == group) { \
+			cp = target_; \
+		} else if (taken_) { \
+			const lane_mask_t rest_ = group & ~taken_; \
+			const unsigned char *const park_cp_ = target_ > cp ? target_ : cp; \
+			lanes_park(lanes, target_ > cp ? taken_ : rest_, park_cp_, row + lanes->rows_min); \
+			parked |= target_ > cp ? taken_ : rest_; \
+			group = target_ > cp ? rest_ : taken_; \
+			if (target_ < cp) \
+				cp = target_; \
+			if (park_cp_ < parked_next) \
+				parked_next = park_cp_; \
+			lanes_mask_bytes(group, mask); \
+		} \
+	} while (0)
+
+	// Skip the `SIZE`-byte operand and jump backward by `OFFSET` if data is
+	// nonzero. At the end of a time slice, let the first parked lane run, so
+	// that it may fail and stop later lanes that are stuck in a loop, as it
+	// would when evaluated alone.
+#define LANES_BACK_EDGE(SIZE, OFFSET) \
+	do { \
+		cp += (SIZE); \
+		LANES_BRANCH(lanes_row_nonzero(lanes->rows[row]), cp + (OFFSET)); \
+		if (!--slice_countdown) { \
+			slice_countdown = LANES_SLICE; \
+			if (parked) { \
+				lanes_park(lanes, group, cp, row + lanes->rows_min); \
+				parked |= group; \
+				group = 0; \
+				rotating = true; \
+				goto resume; \
+			} \
+		} \
+	} while (0)
+
+#define LANES_JBN() LANES_BACK_EDGE(4, *(int32_t *)(cp - 4))
+
+	while (true) {
+		if (cp >= parked_next) {
+			// Join the parked lanes here, or let lower ones run first.
+			const int64_t address = row + lanes->rows_min;
+			const lane_mask_t joined = lanes_parked_at(lanes, parked, cp, address);
+			group |= joined;
+			parked &= ~joined;
+			if (lanes_parked_next(lanes, parked, NULL, cp) < cp) {
+				lanes_park(lanes, group, cp, address);
+				parked |= group;
+				group = 0;
+				goto resume;
+			}
+			parked_next = lanes_parked_next(lanes, parked, cp, code_end);
+			lanes_mask_bytes(group, mask);
+		}
+
+		switch (*cp++) {
+			int32_t offset;
+			size_t size;
+			int64_t first;
+
+		case (unsigned char)HGBF_OP_NXT:
+			LANES_MOVE(1);
+			break;
+
+		case (unsigned char)HGBF_OP_PRV:
+			LANES_MOVE(-1);
+			break;
+
+		case (unsigned char)HGBF_OP_INC:
+			lanes_row_add(lanes->rows[row], mask, 1);
+			break;
+
+		case (unsigned char)HGBF_OP_DEC:
+			lanes_row_add(lanes->rows[row], mask, 0xff);
+			break;
+
+		case (unsigned char)HGBF_OP_OUT:
+			for (size_t i = 0; i < HGBF_LANES; i++) {
+				if (group >> i & 1)
+					lane_write(lanes->lanes + i, lanes->rows[row] + i, 1);
+			}
+			break;
+
+		case (unsigned char)HGBF_OP_IN:
+			for (size_t i = 0; i < HGBF_LANES; i++) {
+				struct lane *const lane = lanes->lanes + i;
+				if (!(group >> i & 1))
+					continue;
+				if (lane->input_used < lane->input_size) {
+					lanes->rows[row][i] = lane->input[lane->input_used++];
+				} else {
+					// The lanes after a failed one would not be evaluated one by one.
+					const lane_mask_t stopped = ~(((lane_mask_t)1 << i) - 1);
+					failed |= (group | parked) & stopped;
+					group &= ~stopped;
+					parked &= ~stopped;
+				}
+			}
+			if (!group)
+				goto resume;
+			lanes_mask_bytes(group, mask);
+			break;
+
+		case (unsigned char)HGBF_OP_JFZ:
+			cp += 4;
+			LANES_BRANCH(~lanes_row_nonzero(lanes->rows[row]), cp + *(int32_t *)(cp - 4));
+			break;
+
+		case (unsigned char)HGBF_OP_JFN:
+			cp += 4;
+			LANES_BRANCH(lanes_row_nonzero(lanes->rows[row]), cp + *(int32_t *)(cp - 4));
+			break;
+
+		case (unsigned char)HGBF_OP_JBN:
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_JBNs:
+			LANES_BACK_EDGE(1, -(ptrdiff_t)cp[-1]);
+			break;
+
+		case (unsigned char)HGBF_OP_HLT:
+			group = 0;
+			goto resume;
+
+		case (unsigned char)HGBF_OP_NXTn:
+			LANES_MOVE(*(uint16_t *)cp);
+			cp += 2;
+			break;
+
+		case (unsigned char)HGBF_OP_PRVn:
+			LANES_MOVE(-(int64_t)*(uint16_t *)cp);
+			cp += 2;
+			break;
+
+		case (unsigned char)HGBF_OP_INCn:
+			lanes_row_add(lanes->rows[row], mask, *cp++);
+			break;
+
+		case (unsigned char)HGBF_OP_DECn:
+			lanes_row_add(lanes->rows[row], mask, (unsigned char)-*cp++);
+			break;
+
+		case (unsigned char)HGBF_OP_UNXT:
+			row++;
+			break;
+
+		case (unsigned char)HGBF_OP_UPRV:
+			row--;
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTn:
+			row += *(uint16_t *)cp;
+			cp += 2;
+			break;
+
+		case (unsigned char)HGBF_OP_UPRVn:
+			row -= *(uint16_t *)cp;
+			cp += 2;
+			break;
+
+		case (unsigned char)HGBF_OP_ENSR:
+			// Reserve the range instead of taking the checked path.
+			if ((row < *cp || row + *(uint16_t *)(cp + 1) >= (int64_t)lanes->row_count) &&
+					!lanes_reserve_at(lanes, &row, -(int64_t)*cp, *(uint16_t *)(cp + 1)))
+				cp += *(int32_t *)(cp + 3);
+			cp += 7;
+			break;
+
+		case (unsigned char)HGBF_OP_JMP:
+			cp += 4;
+			cp += *(int32_t *)(cp - 4);
+			break;
+
+		case (unsigned char)HGBF_OP_LOAD:
+		case (unsigned char)HGBF_OP_ADDV:
+			first = row + *(int32_t *)cp;
+			size = *(uint16_t *)(cp + 4);
+			if (first < 0 || first + (int64_t)size > (int64_t)lanes->row_count) {
+				offset = *(int32_t *)cp;
+				if (!lanes_reserve_at(lanes, &row, offset, (int64_t)offset + (int64_t)size - 1))
+					goto drop;
+				first = row + offset;
+			}
+			if (cp[-1] == (unsigned char)HGBF_OP_LOAD) {
+				for (size_t i = 0; i < size; i++)
+					lanes_row_set(lanes->rows[first + (int64_t)i], mask, cp[6 + i]);
+			} else {
+				for (size_t i = 0; i < size; i++)
+					lanes_row_add(lanes->rows[first + (int64_t)i], mask, cp[6 + i]);
+			}
+			cp += 6 + size;
+			break;
+
+		case (unsigned char)HGBF_OP_SOLVE:
+			size = *(uint16_t *)(cp + 1);
+			if (!lanes_solve(lanes, &row, group, *cp, cp + 3, size))
+				goto drop;
+			cp += 3 + size;
+			break;
+
+		case (unsigned char)HGBF_OP_PUT:
+			size = *(uint16_t *)cp;
+			for (size_t i = 0; i < HGBF_LANES; i++) {
+				if (group >> i & 1)
+					lane_write(lanes->lanes + i, cp + 2, size);
+			}
+			cp += 2 + size;
+			break;
+
+		case (unsigned char)HGBF_OP_DECJBN:
+			lanes_row_add(lanes->rows[row], mask, 0xff);
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_NXTJBN:
+			LANES_MOVE(1);
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_PRVJBN:
+			LANES_MOVE(-1);
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTJBN:
+			row++;
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_UPRVJBN:
+			row--;
+			LANES_JBN();
+			break;
+
+		case (unsigned char)HGBF_OP_NXTINC:
+			LANES_MOVE(1);
+			lanes_row_add(lanes->rows[row], mask, 1);
+			break;
+
+		case (unsigned char)HGBF_OP_INCNXT:
+			lanes_row_add(lanes->rows[row], mask, 1);
+			LANES_MOVE(1);
+			break;
+
+		case (unsigned char)HGBF_OP_UNXTINC:
+			lanes_row_add(lanes->rows[++row], mask, 1);
+			break;
+
+		case (unsigned char)HGBF_OP_INCUNXT:
+			lanes_row_add(lanes->rows[row++], mask, 1);
+			break;
+
+		default:
+			// Leave unknown instructions to the scalar evaluator.
+			goto drop;
+		}
+		continue;
+
+	drop:
+	{
+		// The scalar evaluator runs the dropped lanes and all after the first
+		// of them, which would not be evaluated if it failed.
+		size_t lowest = 0;
+		while (!(group >> lowest & 1))
+			lowest++;
+		const lane_mask_t stopped = ~(((lane_mask_t)1 << lowest) - 1);
+		failed |= group | (parked & stopped);
+		parked &= ~stopped;
+		group = 0;
+	}
+	resume:
+		// Run the parked lanes at the lowest position, or those with the first one.
+		if (!parked)
+			break;
+		size_t next = HGBF_LANES;
+		for (size_t i = 0; i < HGBF_LANES; i++) {
+			if ((parked >> i & 1) && (next == HGBF_LANES ||
+					(!rotating && lanes->lanes[i].cp < lanes->lanes[next].cp)))
+				next = i;
+		}
+		rotating = false;
+		cp = lanes->lanes[next].cp;
+		row = lanes->lanes[next].address - lanes->rows_min;
+		group = lanes_parked_at(lanes, parked, cp, row + lanes->rows_min);
+		parked &= ~group;
+		parked_next = lanes_parked_next(lanes, parked, cp, code_end);
+		lanes_mask_bytes(group, mask);
+	}
+
+#undef LANES_JBN
+#undef LANES_BACK_EDGE
+#undef LANES_BRANCH
+#undef LANES_MOVE
+
+	memset(lanes->rows, 0, lanes->row_count * sizeof(lanes_row_t));
+	return failed;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct hgbf_code hgbf_code_t;
+
+// Number of inputs evaluated in lockstep.
+#define HGBF_LANES 16
+
+// Lockstep evaluator, which runs the same packed code on up to `HGBF_LANES`
+// independent inputs at once, each starting with all cells being zero. Cells
+// of the lanes are interleaved, so one step of the code updates all of them.
+typedef struct hgbf_lanes hgbf_lanes_t;
+
+// Create a lockstep evaluator.
+hgbf_lanes_t *hgbf_lanes_new(void);
+
+// Free the evaluator.
+void hgbf_lanes_free(hgbf_lanes_t *lanes);
+
+// Evaluate code on `count` inputs, the i-th one on lane i. Lanes that fail or
+// drift too far apart are stopped, and so are the lanes after a failed one;
+// return a mask of them (bit i for lane i), to be evaluated again in order by
+// the scalar evaluator.
+uint32_t hgbf_lanes_eval(hgbf_lanes_t *lanes, const hgbf_code_t *code,
+	const unsigned char *const inputs[], const size_t input_sizes[], size_t count);
+
+// Get output of a lane of the last evaluation and the number of input bytes it read.
+const unsigned char *hgbf_lanes_output(const hgbf_lanes_t *lanes,
+	size_t lane, size_t *size, size_t *input_used);
@@ -1,23 +1,94 @@
 #pragma once
 
+#include <stdint.h>
+
+// Operand layouts are strings of field types: `B'/`H'/`I' for unsigned
+// 1/2/4-byte integers, `b'/`h'/`i' for signed ones, `j' for a 4-byte jump
+// offset from the end of the instruction, and `*' for raw data whose size is
+// given by the previous operand. A layout has at most one field of each size.
 #define HGBF_OPCODE_LIST \
-	HGBF_OPCODE_LIST_ENTRY(NXT , 0x00, 0) /* next data cell */ \
-	HGBF_OPCODE_LIST_ENTRY(PRV , 0x01, 0) /* previous data cell */ \
-	HGBF_OPCODE_LIST_ENTRY(INC , 0x02, 0) /* increase data */ \
-	HGBF_OPCODE_LIST_ENTRY(DEC , 0x03, 0) /* decrease data */ \
-	HGBF_OPCODE_LIST_ENTRY(OUT , 0x04, 0) /* output data as ASCII */ \
-	HGBF_OPCODE_LIST_ENTRY(IN  , 0x05, 0) /* input data as ASCII */ \
-	HGBF_OPCODE_LIST_ENTRY(JFZ , 0x06, 4) /* jump forward if data is zero */ \
-	HGBF_OPCODE_LIST_ENTRY(JBN , 0x07, 4) /* jump backward if data is nonzero */ \
-	HGBF_OPCODE_LIST_ENTRY(HLT , 0x08, 0) /* halt */ \
-	HGBF_OPCODE_LIST_ENTRY(NXTn, 0x09, 2) /* NXT * n */ \
-	HGBF_OPCODE_LIST_ENTRY(PRVn, 0x0a, 2) /* PRV * n */ \
-	HGBF_OPCODE_LIST_ENTRY(INCn, 0x0b, 1) /* INC * n */ \
-	HGBF_OPCODE_LIST_ENTRY(DECn, 0x0c, 1) /* DEC * n */ \
+	HGBF_OPCODE_LIST_ENTRY(NXT    , 0x00, ""   ) /* next data cell */ \
+	HGBF_OPCODE_LIST_ENTRY(PRV    , 0x01, ""   ) /* previous data cell */ \
+	HGBF_OPCODE_LIST_ENTRY(INC    , 0x02, ""   ) /* increase data */ \
+	HGBF_OPCODE_LIST_ENTRY(DEC    , 0x03, ""   ) /* decrease data */ \
+	HGBF_OPCODE_LIST_ENTRY(OUT    , 0x04, ""   ) /* output data as ASCII */ \
+	HGBF_OPCODE_LIST_ENTRY(IN     , 0x05, ""   ) /* input data as ASCII */ \
+	HGBF_OPCODE_LIST_ENTRY(JFZ    , 0x06, "j"  ) /* jump forward if data is zero */ \
+	HGBF_OPCODE_LIST_ENTRY(JBN    , 0x07, "j"  ) /* jump backward if data is nonzero */ \
+	HGBF_OPCODE_LIST_ENTRY(HLT    , 0x08, ""   ) /* halt */ \
+	HGBF_OPCODE_LIST_ENTRY(NXTn   , 0x09, "H"  ) /* NXT * n */ \
+	HGBF_OPCODE_LIST_ENTRY(PRVn   , 0x0a, "H"  ) /* PRV * n */ \
+	HGBF_OPCODE_LIST_ENTRY(INCn   , 0x0b, "B"  ) /* INC * n */ \
+	HGBF_OPCODE_LIST_ENTRY(DECn   , 0x0c, "B"  ) /* DEC * n */ \
+	HGBF_OPCODE_LIST_ENTRY(UNXT   , 0x0d, ""   ) /* NXT without bounds check */ \
+	HGBF_OPCODE_LIST_ENTRY(UPRV   , 0x0e, ""   ) /* PRV without bounds check */ \
+	HGBF_OPCODE_LIST_ENTRY(UNXTn  , 0x0f, "H"  ) /* NXTn without bounds check */ \
+	HGBF_OPCODE_LIST_ENTRY(UPRVn  , 0x10, "H"  ) /* PRVn without bounds check */ \
+	HGBF_OPCODE_LIST_ENTRY(ENSR   , 0x11, "BHj") /* jump forward if cells [-a, +b] are not directly addressable */ \
+	HGBF_OPCODE_LIST_ENTRY(JMP    , 0x12, "j"  ) /* jump unconditionally */ \
+	HGBF_OPCODE_LIST_ENTRY(LOAD   , 0x13, "iH*") /* copy data to cells starting from offset */ \
+	HGBF_OPCODE_LIST_ENTRY(PUT    , 0x14, "H*" ) /* output data */ \
+	HGBF_OPCODE_LIST_ENTRY(DECJBN , 0x15, "j"  ) /* DEC, JBN */ \
+	HGBF_OPCODE_LIST_ENTRY(NXTJBN , 0x16, "j"  ) /* NXT, JBN */ \
+	HGBF_OPCODE_LIST_ENTRY(PRVJBN , 0x17, "j"  ) /* PRV, JBN */ \
+	HGBF_OPCODE_LIST_ENTRY(UNXTJBN, 0x18, "j"  ) /* UNXT, JBN */ \
+	HGBF_OPCODE_LIST_ENTRY(UPRVJBN, 0x19, "j"  ) /* UPRV, JBN */ \
+	HGBF_OPCODE_LIST_ENTRY(NXTINC , 0x1a, ""   ) /* NXT, INC */ \
+	HGBF_OPCODE_LIST_ENTRY(INCNXT , 0x1b, ""   ) /* INC, NXT */ \
+	HGBF_OPCODE_LIST_ENTRY(UNXTINC, 0x1c, ""   ) /* UNXT, INC */ \
+	HGBF_OPCODE_LIST_ENTRY(INCUNXT, 0x1d, ""   ) /* INC, UNXT */ \
+	HGBF_OPCODE_LIST_ENTRY(ADDV   , 0x1e, "iH*") /* add data to cells starting from offset, cell by cell */ \
+	HGBF_OPCODE_LIST_ENTRY(JFN    , 0x1f, "j"  ) /* jump forward if data is nonzero */ \
+	HGBF_OPCODE_LIST_ENTRY(SOLVE  , 0x20, "BH*") /* run a linear loop with counter step in closed form */ \
+	HGBF_OPCODE_LIST_ENTRY(OUTZ   , 0x21, ""   ) /* output data and move to next cell until data is zero, `[.>]' */ \
+	HGBF_OPCODE_LIST_ENTRY(CAT    , 0x22, ""   ) /* copy input to output until a zero byte, `,[.,]' */ \
+	HGBF_OPCODE_LIST_ENTRY(JBNs   , 0x23, "B"  ) /* JBN to n bytes before the end of the instruction; packed layout only */ \
+	HGBF_OPCODE_LIST_ENTRY(TJFZ   , 0x24, "Hj" ) /* JFZ of tiered loop n, which runs its kernel instead once it is optimized */ \
+	HGBF_OPCODE_LIST_ENTRY(TJBN   , 0x25, "Hj" ) /* JBN of tiered loop n, counting back-edges; goes on with the kernel once optimized */ \
 // HGBF_OPCODE_LIST
 
+// ADDV data is zero-padded to a multiple of this size, to be added in chunks.
+#define HGBF_ADDV_CHUNK 16
+
+// SOLVE data is a list of terms, each an `i' target offset, an `i' source
+// offset and a `B' factor. For a trip count n, each term adds n * factor *
+// (cell at the source offset, or 1 if the source offset is 0) to the cell at
+// the target offset; the counter is then cleared. Source cells are not targets.
+#define HGBF_SOLVE_TERM_SIZE 9
+
+// Number of iterations of a loop whose counter starts from `value` and changes
+// by `step` each iteration, or -1 if the loop never ends.
+static inline int hgbf_trip_count(unsigned char value, unsigned char step)
+{
+	if (!value)
+		return 0;
+	if (!step)
+		return -1;
+	unsigned int shift = 0;
+	while (!(step >> shift & 1))
+		shift++;
+	if (value & ((1u << shift) - 1))
+		return -1;
+	// The odd part of the step is invertible modulo 256.
+	const unsigned int odd = step >> shift;
+	unsigned int inverse = odd;
+	for (int i = 0; i < 3; i++)
+		inverse *= 2 - odd * inverse;
+	return (int)((((0x100u - value) >> shift) * inverse) & (0xffu >> shift));
+}
+
 typedef enum {
 #define HGBF_OPCODE_LIST_ENTRY(NAME, CODE, OPRD) HGBF_OP_ ##NAME = CODE ,
 	HGBF_OPCODE_LIST
 #undef HGBF_OPCODE_LIST_ENTRY
 } hgbf_opcode_t;
+
+// Instruction word of the aligned code layout. Operands are stored to the
+// field of their size, where a `j' operand is the index of the target word.
+// Raw data of a `*' operand fills the following words.
+typedef struct {
+	uint8_t op;
+	uint8_t b; // `B'/`b' operand.
+	uint16_t h; // `H'/`h' operand.
+	int32_t i; // `I'/`i'/`j' operand.
+} hgbf_word_t;
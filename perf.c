@@ -0,0 +1,194 @@
+#if defined __linux__
+#	define _GNU_SOURCE // syscall()
+#endif // __linux__
+
+#include "perf.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined __linux__
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif // __linux__
+
+#if !defined _WIN32
+#	include <sys/resource.h>
+#	include <sys/time.h>
+#endif // _WIN32
+
+#if defined __linux__
+
+#define PERF_CACHE_READ_MISS(CACHE) \
+	(PERF_COUNT_HW_CACHE_ ##CACHE | PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+		PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const struct perf_counter {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} perf_counters[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"L1D-read-misses", PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(L1D)},
+	{"LLC-read-misses", PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(LL)},
+};
+
+#define PERF_COUNTER_COUNT (sizeof perf_counters / sizeof perf_counters[0])
+
+#endif // __linux__
+
+struct hgbf_perf {
+#if defined __linux__
+	int fds[PERF_COUNTER_COUNT]; // -1 if the counter is unavailable.
+	int open_errno; // Error of the first counter that failed to open.
+#endif // __linux__
+	struct timespec wall_start;
+	double wall_time;
+	double user_start, user_time;
+	double sys_start, sys_time;
+};
+
+#if !defined _WIN32
+
+static double timeval_seconds(struct timeval tv)
+{
+	return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+}
+
+#endif // _WIN32
+
+// Get user and system CPU times of the process. Zeros if unsupported.
+static void cpu_times(double *user, double *sys)
+{
+#if !defined _WIN32
+	struct rusage usage;
+	if (!getrusage(RUSAGE_SELF, &usage)) {
+		*user = timeval_seconds(usage.ru_utime);
+		*sys = timeval_seconds(usage.ru_stime);
+		return;
+	}
+#endif // _WIN32
+	*user = 0.0, *sys = 0.0;
+}
+
+hgbf_perf_t *hgbf_perf_new(void)
+{
+	hgbf_perf_t *const perf = calloc(1, sizeof *perf);
+	if (!perf)
+		return NULL;
+
+#if defined __linux__
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = perf_counters[i].type;
+		attr.config = perf_counters[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format =
+			PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		perf->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (perf->fds[i] < 0 && !perf->open_errno)
+			perf->open_errno = errno;
+	}
+#endif // __linux__
+
+	return perf;
+}
+
+void hgbf_perf_free(hgbf_perf_t *perf)
+{
+	if (!perf)
+		return;
+#if defined __linux__
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (perf->fds[i] >= 0)
+			close(perf->fds[i]);
+	}
+#endif // __linux__
+	free(perf);
+}
+
+void hgbf_perf_start(hgbf_perf_t *perf)
+{
+	cpu_times(&perf->user_start, &perf->sys_start);
+	timespec_get(&perf->wall_start, TIME_UTC);
+#if defined __linux__
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (perf->fds[i] >= 0)
+			ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif // __linux__
+}
+
+void hgbf_perf_stop(hgbf_perf_t *perf)
+{
+#if defined __linux__
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+		if (perf->fds[i] >= 0)
+			ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+#endif // __linux__
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	perf->wall_time += (double)(now.tv_sec - perf->wall_start.tv_sec) +
+		(double)(now.tv_nsec - perf->wall_start.tv_nsec) * 1e-9;
+	double user, sys;
+	cpu_times(&user, &sys);
+	perf->user_time += user - perf->user_start;
+	perf->sys_time += sys - perf->sys_start;
+}
+
+void hgbf_perf_report(const hgbf_perf_t *perf,
+	const hgbf_eval_stats_t *stats, FILE *fp)
+{
+	const double insts = stats->instructions ? (double)stats->instructions : 1.0;
+
+	fprintf(fp, "perf: wall-clock %.6f s, user %.6f s, system %.6f s\n",
+		perf->wall_time, perf->user_time, perf->sys_time);
+	fprintf(fp, "perf: %llu instructions executed (%.3f ns each), "
+		"%llu loop back-edges taken\n",
+		(unsigned long long)stats->instructions, perf->wall_time * 1e9 / insts,
+		(unsigned long long)stats->backedges);
+	fprintf(fp, "perf: %llu bytes input, %llu bytes output, %zu bytes cells peak",
+		(unsigned long long)stats->input_bytes,
+		(unsigned long long)stats->output_bytes, stats->peak_mem);
+#if !defined _WIN32
+	struct rusage usage;
+	if (!getrusage(RUSAGE_SELF, &usage))
+		fprintf(fp, ", %ld KiB max RSS", (long)usage.ru_maxrss);
+#endif // _WIN32
+	fputc('\n', fp);
+
+#if defined __linux__
+	bool any_counter = false;
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+		struct { uint64_t value, time_enabled, time_running; } data;
+		if (perf->fds[i] < 0 || read(perf->fds[i], &data, sizeof data) != sizeof data)
+			continue;
+		any_counter = true;
+		// Scale up if the counter was multiplexed with others.
+		double value = (double)data.value;
+		if (data.time_running && data.time_running < data.time_enabled)
+			value *= (double)data.time_enabled / (double)data.time_running;
+		fprintf(fp, "perf: %-16s %16.0f (%.3f per instruction)\n",
+			perf_counters[i].name, value, value / insts);
+	}
+	if (!any_counter) {
+		fprintf(fp, "perf: hardware counters unavailable: %s\n",
+			perf->open_errno ? strerror(perf->open_errno) : "no data");
+	}
+#else // !__linux__
+	fputs("perf: hardware counters unavailable on this platform\n", fp);
+#endif // __linux__
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "eval.h"
+
+// Performance measurement of evaluations. Hardware counters are read with
+// perf_event_open(2) where available; wall-clock and CPU times always are.
+typedef struct hgbf_perf hgbf_perf_t;
+
+// Create a measurement. Counters that cannot be opened are left out.
+hgbf_perf_t *hgbf_perf_new(void);
+
+// Free the measurement.
+void hgbf_perf_free(hgbf_perf_t *perf);
+
+// Start measuring.
+void hgbf_perf_start(hgbf_perf_t *perf);
+
+// Stop measuring. Results of each start-stop pair are added up.
+void hgbf_perf_stop(hgbf_perf_t *perf);
+
+// Print results, relating them to the evaluation statistics.
+void hgbf_perf_report(const hgbf_perf_t *perf,
+	const hgbf_eval_stats_t *stats, FILE *fp);
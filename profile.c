@@ -0,0 +1,131 @@
+#include "profile.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+
+#define PROFILE_MAGIC "hgbf-profile 2"
+
+typedef struct {
+	hgbf_profile_loop_t counts;
+	bool recorded;
+} profile_entry_t;
+
+struct hgbf_profile {
+	profile_entry_t *loops; // Indexed by loop number.
+	size_t capacity;
+	uint64_t script_hash;
+};
+
+hgbf_profile_t *hgbf_profile_new(void)
+{
+	hgbf_profile_t *const profile = malloc(sizeof(hgbf_profile_t));
+	profile->loops = NULL;
+	profile->capacity = 0;
+	profile->script_hash = 0;
+	return profile;
+}
+
+hgbf_profile_t *hgbf_profile_load(const char *file)
+{
+	FILE *const fp = fopen(file, "r");
+	if (!fp) {
+		hgbf_err_record("cannot open profile %s", file);
+		return NULL;
+	}
+	char line[64];
+	if (!fgets(line, sizeof line, fp) || strcmp(line, PROFILE_MAGIC "\n")) {
+		hgbf_err_record("%s is not a profile", file);
+		fclose(fp);
+		return NULL;
+	}
+	uint64_t script_hash;
+	if (fscanf(fp, "script %" SCNx64, &script_hash) != 1) {
+		hgbf_err_record("profile %s is broken", file);
+		fclose(fp);
+		return NULL;
+	}
+	hgbf_profile_t *const profile = hgbf_profile_new();
+	profile->script_hash = script_hash;
+	uint32_t loop;
+	uint64_t entries, iterations;
+	int n;
+	while ((n = fscanf(fp, "%" SCNu32 " %" SCNu64 " %" SCNu64,
+			&loop, &entries, &iterations)) == 3)
+		hgbf_profile_add(profile, loop, entries, iterations);
+	fclose(fp);
+	if (n != EOF) {
+		hgbf_err_record("profile %s is broken", file);
+		hgbf_profile_free(profile);
+		return NULL;
+	}
+	return profile;
+}
+
+int hgbf_profile_save(const hgbf_profile_t *profile, const char *file)
+{
+	FILE *const fp = fopen(file, "w");
+	if (!fp) {
+		hgbf_err_record("cannot open profile %s", file);
+		return -1;
+	}
+	fputs(PROFILE_MAGIC "\n", fp);
+	fprintf(fp, "script %016" PRIx64 "\n", profile->script_hash);
+	for (size_t i = 0; i < profile->capacity; i++) {
+		const profile_entry_t *const entry = profile->loops + i;
+		if (entry->recorded) {
+			fprintf(fp, "%zu %" PRIu64 " %" PRIu64 "\n",
+				i, entry->counts.entries, entry->counts.iterations);
+		}
+	}
+	if (fclose(fp)) {
+		hgbf_err_record("cannot write profile %s", file);
+		return -1;
+	}
+	return 0;
+}
+
+void hgbf_profile_free(hgbf_profile_t *profile)
+{
+	free(profile->loops);
+	free(profile);
+}
+
+void hgbf_profile_add(hgbf_profile_t *profile,
+	uint32_t loop, uint64_t entries, uint64_t iterations)
+{
+	if (loop >= profile->capacity) {
+		size_t capacity = profile->capacity ? profile->capacity : 64;
+		while (capacity <= loop)
+			capacity *= 2;
+		profile->loops = realloc(profile->loops, sizeof(profile_entry_t) * capacity);
+		memset(profile->loops + profile->capacity, 0,
+			sizeof(profile_entry_t) * (capacity - profile->capacity));
+		profile->capacity = capacity;
+	}
+	profile_entry_t *const entry = profile->loops + loop;
+	entry->counts.entries += entries;
+	entry->counts.iterations += iterations;
+	entry->recorded = true;
+}
+
+const hgbf_profile_loop_t *hgbf_profile_get(const hgbf_profile_t *profile, uint32_t loop)
+{
+	if (loop >= profile->capacity || !profile->loops[loop].recorded)
+		return NULL;
+	return &profile->loops[loop].counts;
+}
+
+void hgbf_profile_set_script(hgbf_profile_t *profile, uint64_t script_hash)
+{
+	profile->script_hash = script_hash;
+}
+
+uint64_t hgbf_profile_script(const hgbf_profile_t *profile)
+{
+	return profile->script_hash;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// Runtime profile of the loops of a script. Loops are numbered from 1 in the
+// order of their `['s in the script, which is identified by its hash.
+typedef struct hgbf_profile hgbf_profile_t;
+
+// Counts of a loop.
+typedef struct {
+	uint64_t entries; // Times the loop body was entered from its `['.
+	uint64_t iterations; // Times its `]' jumped back.
+} hgbf_profile_loop_t;
+
+// Create an empty profile.
+hgbf_profile_t *hgbf_profile_new(void);
+
+// Load a profile from file. If error occurred, return NULL and record error message.
+hgbf_profile_t *hgbf_profile_load(const char *file);
+
+// Save the profile to file. On success, return 0; on failure, return -1 and
+// record error message.
+int hgbf_profile_save(const hgbf_profile_t *profile, const char *file);
+
+// Free the profile.
+void hgbf_profile_free(hgbf_profile_t *profile);
+
+// Add counts to a loop.
+void hgbf_profile_add(hgbf_profile_t *profile,
+	uint32_t loop, uint64_t entries, uint64_t iterations);
+
+// Get counts of a loop. Return NULL if the loop was never reached by code.
+const hgbf_profile_loop_t *hgbf_profile_get(const hgbf_profile_t *profile, uint32_t loop);
+
+// Set the hash of the script that the profile is of.
+void hgbf_profile_set_script(hgbf_profile_t *profile, uint64_t script_hash);
+
+// Get the hash of the script that the profile is of.
+uint64_t hgbf_profile_script(const hgbf_profile_t *profile);
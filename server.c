@@ -0,0 +1,281 @@
+#if !defined _WIN32
+#	define _POSIX_C_SOURCE 200809L // fdopen(), dup()
+#endif // _WIN32
+
+#include "server.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined _WIN32
+#	include <sys/socket.h>
+#	include <sys/stat.h>
+#	include <sys/time.h>
+#	include <sys/un.h>
+#	include <unistd.h>
+#endif // _WIN32
+
+#include "code.h"
+#include "error.h"
+#include "eval.h"
+#include "stream.h"
+
+#if !defined _WIN32
+
+#define CACHE_SIZE 64
+#define HEADER_SIZE_MAX 128
+#define TIMEOUT_SEC 10 // Longest wait for a client to send or receive data.
+
+// Compiled code, keyed by the hash of its script.
+typedef struct {
+	uint64_t hash;
+	char *script; // The script, for scripts that collide on the hash.
+	size_t script_size;
+	hgbf_code_t *code; // NULL if the entry is empty.
+	uint64_t last_use;
+} cache_entry_t;
+
+// Least recently used compiled code.
+typedef struct {
+	cache_entry_t entries[CACHE_SIZE];
+	uint64_t clock;
+} cache_t;
+
+// Find the code of the hash, and of the script too unless it is NULL.
+static hgbf_code_t *cache_find(cache_t *cache, uint64_t hash,
+	const char *script, size_t script_size)
+{
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		cache_entry_t *const entry = cache->entries + i;
+		if (entry->code && entry->hash == hash) {
+			if (script && (entry->script_size != script_size ||
+					memcmp(entry->script, script, script_size)))
+				return NULL;
+			entry->last_use = ++cache->clock;
+			return entry->code;
+		}
+	}
+	return NULL;
+}
+
+// Add code and its script to the cache, taking the ownership of them. Replace
+// the entry of the same hash if any, or the least recently used one if full.
+static void cache_insert(cache_t *cache, uint64_t hash,
+	char *script, size_t script_size, hgbf_code_t *code)
+{
+	cache_entry_t *victim = cache->entries;
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		cache_entry_t *const entry = cache->entries + i;
+		if (!entry->code || entry->hash == hash) {
+			victim = entry;
+			break;
+		}
+		if (entry->last_use < victim->last_use)
+			victim = entry;
+	}
+	if (victim->code) {
+		hgbf_code_free(victim->code);
+		free(victim->script);
+	}
+	victim->hash = hash;
+	victim->script = script;
+	victim->script_size = script_size;
+	victim->code = code;
+	victim->last_use = ++cache->clock;
+}
+
+static void cache_destroy(cache_t *cache)
+{
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		if (cache->entries[i].code) {
+			hgbf_code_free(cache->entries[i].code);
+			free(cache->entries[i].script);
+		}
+	}
+}
+
+static uint64_t script_hash(const char *script, size_t size)
+{
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)script[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+// Read a payload of the size. Return NULL on failure.
+static char *read_payload(FILE *fp, size_t size)
+{
+	char *const data = malloc(size ? size : 1);
+	if (data && fread(data, 1, size, fp) != size) {
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+// Send output as an OUT frame.
+static int send_output(void *context, const void *data, size_t size)
+{
+	FILE *const fp = context;
+	if (fprintf(fp, "OUT %zu\n", size) < 0 || fwrite(data, 1, size, fp) != size)
+		return -1;
+	return fflush(fp) ? -1 : 0;
+}
+
+// Handle one request. Return -1 if the connection should be closed.
+static int serve_request(const char *header, FILE *in, FILE *out,
+	cache_t *cache, hgbf_tape_t *tape)
+{
+	uint64_t hash;
+	size_t script_size, input_size;
+	char *script = NULL;
+	if (sscanf(header, "RUN %zu %zu", &script_size, &input_size) == 2) {
+		if (!(script = read_payload(in, script_size)))
+			return -1;
+		hash = script_hash(script, script_size);
+	} else if (sscanf(header, "HASH %" SCNx64 " %zu", &hash, &input_size) != 2) {
+		fputs("ERR bad request\n", out);
+		return -1;
+	}
+	char *const input = read_payload(in, input_size);
+	if (!input) {
+		free(script);
+		return -1;
+	}
+
+	hgbf_code_t *code = cache_find(cache, hash, script, script_size);
+	if (!code && script) {
+		hgbf_istream_t *const script_stream = hgbf_istream_open_mem(script, script_size);
+		code = hgbf_code_compile(script_stream);
+		hgbf_istream_close(script_stream);
+		if (code) {
+			cache_insert(cache, hash, script, script_size, code);
+			script = NULL;
+		} else {
+			fprintf(out, "ERR syntax error: %s\n", hgbf_err_read());
+		}
+	} else if (!code) {
+		fputs("ERR unknown script\n", out);
+	}
+	free(script);
+
+	if (code) {
+		const hgbf_eval_io_t io = {
+			.i = hgbf_istream_open_mem(input, input_size),
+			.o = hgbf_ostream_open_sink(send_output, out),
+		};
+		const int eval_err = hgbf_tape_eval(tape, code, io);
+		hgbf_istream_close(io.i);
+		hgbf_ostream_close(io.o);
+		if (eval_err)
+			fprintf(out, "ERR runtime error: %s\n", hgbf_err_read());
+		else
+			fprintf(out, "OK %016" PRIx64 "\n", hash);
+	}
+	free(input);
+	return fflush(out) ? -1 : 0;
+}
+
+static void serve_connection(int fd, cache_t *cache, hgbf_tape_t *tape)
+{
+	// A client that stalls must not hold up the others for long.
+	const struct timeval timeout = {.tv_sec = TIMEOUT_SEC};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+	const int out_fd = dup(fd);
+	FILE *const in = fdopen(fd, "rb");
+	FILE *const out = out_fd >= 0 ? fdopen(out_fd, "wb") : NULL;
+	if (!in || !out) {
+		if (in)
+			fclose(in);
+		else
+			close(fd);
+		if (out)
+			fclose(out);
+		else if (out_fd >= 0)
+			close(out_fd);
+		return;
+	}
+
+	char header[HEADER_SIZE_MAX];
+	while (fgets(header, sizeof header, in)) {
+		if (serve_request(header, in, out, cache, tape))
+			break;
+	}
+	fclose(in);
+	fclose(out);
+}
+
+int hgbf_serve(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr.sun_path) {
+		hgbf_err_record("socket path is too long");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	// Replace a socket left by a previous server, but no other kind of file.
+	struct stat st;
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || bind(sock, (const struct sockaddr *)&addr, sizeof addr) ||
+			listen(sock, SOMAXCONN)) {
+		hgbf_err_record("%s: %s", path, strerror(errno));
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+
+	// Clients that leave early must not end the server.
+	signal(SIGPIPE, SIG_IGN);
+
+	hgbf_tape_t *const tape = hgbf_tape_new();
+	if (!tape) {
+		close(sock);
+		unlink(path);
+		return -1;
+	}
+	cache_t cache;
+	memset(&cache, 0, sizeof cache);
+	while (true) {
+		const int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			hgbf_err_record("%s: %s", path, strerror(errno));
+			break;
+		}
+		serve_connection(conn, &cache, tape);
+	}
+	hgbf_tape_free(tape);
+	cache_destroy(&cache);
+	close(sock);
+	unlink(path);
+	return -1;
+}
+
+#else // _WIN32
+
+int hgbf_serve(const char *path)
+{
+	(void)path;
+	hgbf_err_record("server mode is not supported on this platform");
+	return -1;
+}
+
+#endif // _WIN32
@@ -0,0 +1,16 @@
+#pragma once
+
+// Serve requests on a Unix domain socket at `path`, one connection at a time.
+// A connection carries any number of requests, each a header line followed by
+// payload bytes:
+//   "RUN <script-size> <input-size>\n" <script> <input>
+//   "HASH <script-hash> <input-size>\n" <input>
+// where the hash is the 16-digit hexadecimal one that an earlier RUN reported.
+// The script is evaluated on fresh cells with the input. The response is any
+// number of "OUT <size>\n" <output> frames as output is produced, then either
+// "OK <script-hash>\n" or "ERR <message>\n".
+// A connection is closed when the client sends or receives nothing for 10
+// seconds. A RUN request is compiled again if its script differs from the
+// cached one of the same hash, which then refers to the new script.
+// Return only on failure, with -1 and the error message recorded.
+int hgbf_serve(const char *path);
@@ -0,0 +1,55 @@
+#include "stats.h"
+
+#include <time.h>
+
+double hgbf_stats_clock(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Write a JSON string literal, or null.
+static void write_json_string(const char *s, FILE *fp)
+{
+	if (!s) {
+		fputs("null", fp);
+		return;
+	}
+	fputc('"', fp);
+	for (; *s; s++) {
+		const unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+void hgbf_stats_write_json(const hgbf_stats_t *stats, FILE *fp)
+{
+	fprintf(fp, "{\"compile_time\":%.9f,\"eval_time\":%.9f,\"code_size\":%zu,",
+		stats->compile_time, stats->eval_time, stats->code_size);
+	if (stats->counted)
+		fprintf(fp, "\"instructions\":%llu,", (unsigned long long)stats->eval.instructions);
+	else
+		fputs("\"instructions\":null,", fp);
+	fprintf(fp, "\"backedges\":%llu,", (unsigned long long)stats->eval.backedges);
+	fprintf(fp, "\"input_bytes\":%llu,\"output_bytes\":%llu,\"peak_mem\":%zu,",
+		(unsigned long long)stats->eval.input_bytes,
+		(unsigned long long)stats->eval.output_bytes, stats->eval.peak_mem);
+	fputs("\"error\":", fp);
+	if (stats->error_kind) {
+		fputs("{\"kind\":", fp);
+		write_json_string(stats->error_kind, fp);
+		fputs(",\"message\":", fp);
+		write_json_string(stats->error, fp);
+		fputc('}', fp);
+	} else {
+		fputs("null", fp);
+	}
+	fputs("}\n", fp);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "eval.h"
+
+// Statistics of a run, for monitoring.
+typedef struct {
+	double compile_time, eval_time; // Wall-clock seconds.
+	size_t code_size; // Total bytes of generated code.
+	hgbf_eval_stats_t eval;
+	bool counted; // Whether `eval.instructions` were counted; null in JSON if not.
+	const char *error_kind; // Kind of the last error; NULL if none.
+	char error[256]; // Message of the error.
+} hgbf_stats_t;
+
+// Get current wall-clock time in seconds, to measure durations.
+double hgbf_stats_clock(void);
+
+// Write the statistics as a single-line JSON object.
+void hgbf_stats_write_json(const hgbf_stats_t *stats, FILE *fp);
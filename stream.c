@@ -1,10 +1,28 @@
+#if !defined _WIN32
+#	define _POSIX_C_SOURCE 200809L // mmap(), fstat()
+#endif // _WIN32
+
 #include "stream.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if !defined _WIN32
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif // _WIN32
+#if !defined __STDC_NO_THREADS__ && !defined _WIN32
+#	include <threads.h>
+#	define STREAM_ASYNC
+#endif // __STDC_NO_THREADS__
 
 static inline bool ptr_tagged(void *p)
 {
@@ -25,8 +43,13 @@ typedef struct {
 	const char *current;
 	const char *begin;
 	const char *end;
+	bool mapped; // Whether [begin, end) is a file mapping to be unmapped.
+	int fd; // File to read more data from into the buffer after the view, or -1.
+	hgbf_ostream_t *tie; // Stream to flush before reading from `fd`, or NULL.
 } strview_t;
 
+#define FD_BUFFER_SIZE 0x10000
+
 hgbf_istream_t *hgbf_istream_open_file(const char *path)
 {
 	FILE *const fp = fopen(path, "rb");
@@ -40,10 +63,34 @@ hgbf_istream_t *hgbf_istream_open_mem(const char *str, size_t len)
 	sv->current = str;
 	sv->begin = str;
 	sv->end = str + len;
+	sv->mapped = false;
+	sv->fd = -1;
+	sv->tie = NULL;
 	assert(!ptr_tagged(sv));
 	return ptr_tag(sv);
 }
 
+hgbf_istream_t *hgbf_istream_map_file(const char *path)
+{
+#if !defined _WIN32
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) &&
+			st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX)
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data != MAP_FAILED) {
+		hgbf_istream_t *const stream = hgbf_istream_open_mem(data, (size_t)st.st_size);
+		((strview_t *)ptr_untag(stream))->mapped = true;
+		return stream;
+	}
+#endif // _WIN32
+	return hgbf_istream_open_file(path);
+}
+
 void hgbf_istream_close(hgbf_istream_t *stream)
 {
 	if (!ptr_tagged(stream)) {
@@ -52,6 +99,10 @@ void hgbf_istream_close(hgbf_istream_t *stream)
 	}
 
 	strview_t *const sv = ptr_untag(stream);
+#if !defined _WIN32
+	if (sv->mapped)
+		munmap((void *)sv->begin, (size_t)(sv->end - sv->begin));
+#endif // _WIN32
 	free(sv);
 }
 
@@ -61,6 +112,44 @@ hgbf_istream_t *hgbf_stdin(void)
 	return (hgbf_istream_t *)stdin;
 }
 
+hgbf_istream_t *hgbf_stdin_tied(hgbf_ostream_t *tie)
+{
+#if !defined _WIN32
+	strview_t *const sv = malloc(sizeof(strview_t) + FD_BUFFER_SIZE);
+	sv->begin = sv->current = sv->end = (const char *)(sv + 1);
+	sv->mapped = false;
+	sv->fd = STDIN_FILENO;
+	sv->tie = tie;
+	assert(!ptr_tagged(sv));
+	return ptr_tag(sv);
+#else // _WIN32
+	(void)tie;
+	return hgbf_stdin();
+#endif // _WIN32
+}
+
+// Read more data from the file of an empty view. Return -1 on failure or at the end.
+static int strview_refill(strview_t *sv)
+{
+#if !defined _WIN32
+	if (sv->fd < 0 || (sv->tie && hgbf_ostream_flush(sv->tie)))
+		return -1;
+	char *const buffer = (char *)(sv + 1);
+	ssize_t n;
+	do
+		n = read(sv->fd, buffer, FD_BUFFER_SIZE);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return -1;
+	sv->begin = sv->current = buffer;
+	sv->end = buffer + n;
+	return 0;
+#else // _WIN32
+	(void)sv;
+	return -1;
+#endif // _WIN32
+}
+
 int hgbf_istream_read1(hgbf_istream_t *stream)
 {
 	if (!ptr_tagged(stream))
@@ -68,20 +157,301 @@ int hgbf_istream_read1(hgbf_istream_t *stream)
 
 	strview_t *const sv = ptr_untag(stream);
 	assert(sv->current >= sv->begin && sv->current <= sv->end);
-	if (sv->current < sv->end)
+	if (sv->current < sv->end || !strview_refill(sv))
 		return (int)(unsigned char)(*sv->current++);
 	else
 		return EOF;
 }
 
+const char *hgbf_istream_mem(hgbf_istream_t *stream, size_t *size)
+{
+	if (!ptr_tagged(stream))
+		return NULL;
+
+	strview_t *const sv = ptr_untag(stream);
+	if (sv->fd >= 0)
+		return NULL;
+	*size = (size_t)(sv->end - sv->current);
+	return sv->current;
+}
+
+int hgbf_istream_skip(hgbf_istream_t *stream, size_t size)
+{
+	if (!ptr_tagged(stream)) {
+		FILE *const fp = (FILE *)stream;
+		if (size <= LONG_MAX && !fseek(fp, (long)size, SEEK_CUR))
+			return 0;
+		for (; size; size--) {
+			if (fgetc(fp) == EOF)
+				return -1;
+		}
+		return 0;
+	}
+
+	strview_t *const sv = ptr_untag(stream);
+	while ((size_t)(sv->end - sv->current) < size) {
+		size -= (size_t)(sv->end - sv->current);
+		sv->current = sv->end;
+		if (strview_refill(sv))
+			return -1;
+	}
+	sv->current += size;
+	return 0;
+}
+
+int hgbf_istream_copy(hgbf_istream_t *input, hgbf_ostream_t *output,
+	size_t max, size_t *size)
+{
+	*size = 0;
+	if (!ptr_tagged(input)) {
+		FILE *const fp = (FILE *)input;
+		unsigned char buffer[4096];
+		size_t n = 0;
+		int c = 1; // Stays nonzero if `max` bytes are copied.
+		while (*size + n < max && (c = getc(fp)) > 0) {
+			buffer[n++] = (unsigned char)c;
+			if (n == sizeof buffer) {
+				if (hgbf_ostream_write(output, buffer, n))
+					return -1;
+				*size += n;
+				n = 0;
+			}
+		}
+		if (n && hgbf_ostream_write(output, buffer, n))
+			return -1;
+		*size += n;
+		return c == EOF ? 1 : c ? 2 : 0;
+	}
+
+	strview_t *const sv = ptr_untag(input);
+	while (*size < max && (sv->current < sv->end || !strview_refill(sv))) {
+		size_t n = (size_t)(sv->end - sv->current);
+		if (n > max - *size)
+			n = max - *size;
+		const char *const zero = memchr(sv->current, 0, n);
+		if (zero)
+			n = (size_t)(zero - sv->current);
+		if (n && hgbf_ostream_write(output, sv->current, n))
+			return -1;
+		*size += n;
+		sv->current += n;
+		if (zero) {
+			sv->current++;
+			return 0;
+		}
+	}
+	return *size == max ? 2 : 1;
+}
+
+#define SINK_BUFFER_SIZE 4096
+#define ASYNC_BUFFER_SIZE 0x10000
+
+typedef struct async_writer async_writer_t;
+
+typedef struct {
+	hgbf_ostream_sink_t write;
+	void *context;
+	size_t size; // Bytes in buffer.
+	size_t capacity;
+	unsigned char *buffer;
+	async_writer_t *async; // Thread that writes full buffers instead of `write`, or NULL.
+} sink_t;
+
+#if defined STREAM_ASYNC
+
+// Writer thread, which writes one buffer to a file while the other is filled.
+struct async_writer {
+	int fd;
+	bool close_fd;
+	bool failed; // Whether writing has failed.
+	bool closing; // Whether the thread is to exit.
+	const unsigned char *data; // Data being written; NULL if idle.
+	size_t size;
+	unsigned char *buffers[2];
+	mtx_t lock;
+	cnd_t cond; // Signaled when `data` or `closing` changes.
+	thrd_t thread;
+};
+
+static int async_writer_main(void *arg)
+{
+	async_writer_t *const writer = arg;
+	mtx_lock(&writer->lock);
+	while (true) {
+		while (!writer->data && !writer->closing)
+			cnd_wait(&writer->cond, &writer->lock);
+		if (!writer->data)
+			break;
+		const unsigned char *data = writer->data;
+		size_t size = writer->size;
+		mtx_unlock(&writer->lock);
+		bool ok = true;
+		while (size) {
+			const ssize_t n = write(writer->fd, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				ok = false;
+				break;
+			}
+			data += n;
+			size -= (size_t)n;
+		}
+		mtx_lock(&writer->lock);
+		if (!ok)
+			writer->failed = true;
+		writer->data = NULL;
+		cnd_broadcast(&writer->cond);
+	}
+	mtx_unlock(&writer->lock);
+	return 0;
+}
+
+// Hand the buffered data to the writer thread, after it has written the
+// previous data, and fill the other buffer next.
+static int async_submit(sink_t *sink)
+{
+	async_writer_t *const writer = sink->async;
+	mtx_lock(&writer->lock);
+	if (sink->size) {
+		while (writer->data)
+			cnd_wait(&writer->cond, &writer->lock);
+		if (!writer->failed) {
+			writer->data = sink->buffer;
+			writer->size = sink->size;
+			cnd_broadcast(&writer->cond);
+			sink->buffer = sink->buffer == writer->buffers[0] ?
+				writer->buffers[1] : writer->buffers[0];
+		}
+		sink->size = 0;
+	}
+	const bool failed = writer->failed;
+	mtx_unlock(&writer->lock);
+	return failed ? -1 : 0;
+}
+
+// Write the rest of the data and stop the writer thread.
+static void async_close(sink_t *sink)
+{
+	async_writer_t *const writer = sink->async;
+	async_submit(sink);
+	mtx_lock(&writer->lock);
+	while (writer->data)
+		cnd_wait(&writer->cond, &writer->lock);
+	writer->closing = true;
+	cnd_broadcast(&writer->cond);
+	mtx_unlock(&writer->lock);
+	thrd_join(writer->thread, NULL);
+	cnd_destroy(&writer->cond);
+	mtx_destroy(&writer->lock);
+	if (writer->close_fd)
+		close(writer->fd);
+	free(writer->buffers[0]);
+	free(writer->buffers[1]);
+	free(writer);
+}
+
+#endif // STREAM_ASYNC
+
+static int sink_flush(sink_t *sink)
+{
+#if defined STREAM_ASYNC
+	if (sink->async)
+		return async_submit(sink);
+#endif // STREAM_ASYNC
+	if (!sink->size)
+		return 0;
+	const size_t size = sink->size;
+	sink->size = 0;
+	return sink->write(sink->context, sink->buffer, size);
+}
+
 hgbf_ostream_t *hgbf_ostream_open_file(const char *path)
 {
 	return (hgbf_ostream_t *)fopen(path, "wb");
 }
 
+hgbf_ostream_t *hgbf_ostream_reopen_file(const char *path)
+{
+	FILE *const fp = fopen(path, "r+b");
+	return (hgbf_ostream_t *)(fp ? fp : fopen(path, "wb"));
+}
+
+hgbf_ostream_t *hgbf_ostream_open_sink(hgbf_ostream_sink_t write, void *context)
+{
+	sink_t *const sink = malloc(sizeof(sink_t) + SINK_BUFFER_SIZE);
+	sink->write = write;
+	sink->context = context;
+	sink->size = 0;
+	sink->capacity = SINK_BUFFER_SIZE;
+	sink->buffer = (unsigned char *)(sink + 1);
+	sink->async = NULL;
+	assert(!ptr_tagged(sink));
+	return ptr_tag(sink);
+}
+
+hgbf_ostream_t *hgbf_ostream_open_async(const char *path)
+{
+#if defined STREAM_ASYNC
+	// A terminal is better served by the line buffering of stdio.
+	const int fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666) :
+		isatty(STDOUT_FILENO) ? -1 : STDOUT_FILENO;
+	if (fd < 0)
+		return NULL;
+	if (!path)
+		fflush(stdout);
+	async_writer_t *const writer = malloc(sizeof *writer);
+	writer->fd = fd;
+	writer->close_fd = path != NULL;
+	writer->failed = false;
+	writer->closing = false;
+	writer->data = NULL;
+	writer->size = 0;
+	writer->buffers[0] = malloc(ASYNC_BUFFER_SIZE);
+	writer->buffers[1] = malloc(ASYNC_BUFFER_SIZE);
+	if (mtx_init(&writer->lock, mtx_plain) == thrd_success) {
+		if (cnd_init(&writer->cond) == thrd_success) {
+			if (thrd_create(&writer->thread, async_writer_main, writer) == thrd_success) {
+				sink_t *const sink = malloc(sizeof(sink_t));
+				sink->write = NULL;
+				sink->context = NULL;
+				sink->size = 0;
+				sink->capacity = ASYNC_BUFFER_SIZE;
+				sink->buffer = writer->buffers[0];
+				sink->async = writer;
+				assert(!ptr_tagged(sink));
+				return ptr_tag(sink);
+			}
+			cnd_destroy(&writer->cond);
+		}
+		mtx_destroy(&writer->lock);
+	}
+	free(writer->buffers[0]);
+	free(writer->buffers[1]);
+	free(writer);
+	if (path)
+		close(fd);
+#else // !STREAM_ASYNC
+	(void)path;
+#endif // STREAM_ASYNC
+	return NULL;
+}
+
 void hgbf_ostream_close(hgbf_ostream_t *stream)
 {
-	fclose((FILE *)stream);
+	if (!ptr_tagged(stream)) {
+		fclose((FILE *)stream);
+		return;
+	}
+
+	sink_t *const sink = ptr_untag(stream);
+#if defined STREAM_ASYNC
+	if (sink->async)
+		async_close(sink);
+	else
+#endif // STREAM_ASYNC
+		sink_flush(sink);
+	free(sink);
 }
 
 hgbf_ostream_t *hgbf_stdout(void)
@@ -91,5 +461,53 @@ hgbf_ostream_t *hgbf_stdout(void)
 
 int hgbf_ostream_write1(hgbf_ostream_t *stream, unsigned char data)
 {
-	return fputc((int)data, (FILE *)stream) != EOF ? 0 : -1;
+	if (!ptr_tagged(stream))
+		return fputc((int)data, (FILE *)stream) != EOF ? 0 : -1;
+
+	sink_t *const sink = ptr_untag(stream);
+	if (sink->size == sink->capacity && sink_flush(sink))
+		return -1;
+	sink->buffer[sink->size++] = data;
+	return 0;
+}
+
+int hgbf_ostream_write(hgbf_ostream_t *stream, const void *data, size_t size)
+{
+	if (!ptr_tagged(stream))
+		return fwrite(data, 1, size, (FILE *)stream) == size ? 0 : -1;
+
+	sink_t *const sink = ptr_untag(stream);
+	if (size > sink->capacity - sink->size) {
+		if (sink_flush(sink))
+			return -1;
+		if (size > sink->capacity && !sink->async)
+			return sink->write(sink->context, data, size);
+	}
+	// Data larger than the buffers of the writer thread go in pieces.
+	while (size > sink->capacity) {
+		memcpy(sink->buffer, data, sink->capacity);
+		sink->size = sink->capacity;
+		if (sink_flush(sink))
+			return -1;
+		data = (const unsigned char *)data + sink->capacity;
+		size -= sink->capacity;
+	}
+	memcpy(sink->buffer + sink->size, data, size);
+	sink->size += size;
+	return 0;
+}
+
+int hgbf_ostream_flush(hgbf_ostream_t *stream)
+{
+	if (!ptr_tagged(stream))
+		return fflush((FILE *)stream) ? -1 : 0;
+
+	return sink_flush(ptr_untag(stream));
+}
+
+int hgbf_ostream_seek(hgbf_ostream_t *stream, size_t offset)
+{
+	if (ptr_tagged(stream) || offset > LONG_MAX || fflush((FILE *)stream))
+		return -1;
+	return fseek((FILE *)stream, (long)offset, SEEK_SET) ? -1 : 0;
 }
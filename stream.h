@@ -14,18 +14,53 @@ hgbf_istream_t *hgbf_istream_open_file(const char *path);
 // Open an istream from immutable string.
 hgbf_istream_t *hgbf_istream_open_mem(const char *str, size_t len);
 
+// Open an istream from file, mapping the file to memory if possible.
+hgbf_istream_t *hgbf_istream_map_file(const char *path);
+
 // Close an istream.
 void hgbf_istream_close(hgbf_istream_t *stream);
 
 // Get standard input stream.
 hgbf_istream_t *hgbf_stdin(void);
 
+// Open an istream that reads stdin directly, which flushes `tie` if it is not
+// NULL whenever it has to wait for more input. Closing it leaves stdin open.
+hgbf_istream_t *hgbf_stdin_tied(hgbf_ostream_t *tie);
+
 // Read one byte. Return -1 on failure.
 int hgbf_istream_read1(hgbf_istream_t *stream);
 
+// Get the unread data if the stream reads from memory, otherwise return NULL.
+const char *hgbf_istream_mem(hgbf_istream_t *stream, size_t *size);
+
+// Skip bytes. Return 0 on success or -1 on failure.
+int hgbf_istream_skip(hgbf_istream_t *stream, size_t size);
+
+// Copy at most `max` bytes to `output` up to the first zero byte, which is
+// read but not copied, and store the number of bytes copied to `*size`. Return
+// 0 if a zero byte is read, 1 at the end of input, 2 if `max` bytes are copied,
+// or -1 on output failure.
+int hgbf_istream_copy(hgbf_istream_t *input, hgbf_ostream_t *output,
+	size_t max, size_t *size);
+
 // Open an ostream from file.
 hgbf_ostream_t *hgbf_ostream_open_file(const char *path);
 
+// Open an ostream from file without truncating it if it exists.
+hgbf_ostream_t *hgbf_ostream_reopen_file(const char *path);
+
+// Function that an ostream passes buffered data to. Return 0 on success or -1 on failure.
+typedef int (*hgbf_ostream_sink_t)(void *context, const void *data, size_t size);
+
+// Open an ostream that passes data to `write`, in pieces of buffered data.
+hgbf_ostream_t *hgbf_ostream_open_sink(hgbf_ostream_sink_t write, void *context);
+
+// Open an ostream to file, or to stdout if `path` is NULL, whose data is
+// written by a separate thread from one buffer while the other is filled.
+// Flushing hands the buffered data to the thread; closing waits until all of
+// it is written. Return NULL if not supported or stdout is a terminal.
+hgbf_ostream_t *hgbf_ostream_open_async(const char *path);
+
 // Close an ostream.
 void hgbf_ostream_close(hgbf_ostream_t *stream);
 
@@ -34,3 +69,12 @@ hgbf_ostream_t *hgbf_stdout(void);
 
 // Write one byte. Return 0 on success or -1 on failure.
 int hgbf_ostream_write1(hgbf_ostream_t *stream, unsigned char data);
+
+// Write bytes. Return 0 on success or -1 on failure.
+int hgbf_ostream_write(hgbf_ostream_t *stream, const void *data, size_t size);
+
+// Flush buffered data. Return 0 on success or -1 on failure.
+int hgbf_ostream_flush(hgbf_ostream_t *stream);
+
+// Move to the position if the stream is seekable. Return 0 on success or -1 on failure.
+int hgbf_ostream_seek(hgbf_ostream_t *stream, size_t offset);
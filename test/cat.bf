@@ -0,0 +1,3 @@
+[ Copy input to output up to a zero byte ]
+
+,[.,]
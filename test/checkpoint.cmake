@@ -0,0 +1,14 @@
+# Stop a run at a step limit, resume it from its last checkpoint, and compare
+# the output with the one of an uninterrupted run.
+include("${TEST_DIR}/steps.cmake")
+file(WRITE input "x")
+file(REMOVE checkpoint resumed.txt)
+
+run_step(full 0 "${TEST_DIR}/letters.bf")
+run_step(stopped 1 -C checkpoint -N 50 -S 300 -O resumed.txt "${TEST_DIR}/letters.bf")
+check_match("${step_error}" "step limit exceeded")
+run_step(resumed 0 -R checkpoint -O resumed.txt "${TEST_DIR}/letters.bf")
+check_same(full.out resumed.txt)
+
+run_step(missing 1 -R no-checkpoint "${TEST_DIR}/letters.bf")
+check_match("${step_error}" "cannot open checkpoint")
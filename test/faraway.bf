@@ -0,0 +1,34 @@
+[ Walk between widely separated tape regions ]
+
+++++ ++++ [> ++++ ++++ <-]>+        Cell 1: 65 ('A')
+>> ++++ ++++ ++++ ++++ ++++
+[< ++++ ++++ ++ >-]<                Cell 2: counter (200)
+
+[                                   Carry the counter 32 cells right per step
+	[-
+	>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+
+	<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<]
+	>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>-
+]                                   Now at cell 6402
+
+>> ++++ ++++ [< ++++ ++++ >-]<++    Cell 6403: 66 ('B')
+>> ++++ ++++ ++++ ++++ ++++
+[<<< ++++ ++++ ++ >>>-]<<<          Cell 6402: counter (200)
+
+[                                   Carry the counter back to the left
+	[-
+	<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<+
+	>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>]
+	<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<-
+]                                   Now at cell 2
+<.                                  Print cell 1
+
+>> ++++ ++++ ++++ ++++ ++++
+[< ++++ ++++ ++ >-]<                Cell 2: counter (200)
+[                                   And to the right again
+	[-
+	>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+
+	<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<]
+	>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>-
+]
+>.                                  Print cell 6403
@@ -0,0 +1,3 @@
+[ Loop forever ]
+
++[]
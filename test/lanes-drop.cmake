@@ -0,0 +1,14 @@
+# A record left to the scalar evaluator fails; the records after it must not
+# run on their lanes, where the next one would loop forever.
+include("${TEST_DIR}/steps.cmake")
+string(ASCII 1 one)
+string(ASCII 5 five)
+file(WRITE input "${one}\n${five}\n")
+execute_process(COMMAND "${HGBF}" -b 10 -W -e ",-[[]],[.,]"
+	INPUT_FILE input OUTPUT_VARIABLE out ERROR_VARIABLE err
+	RESULT_VARIABLE res TIMEOUT 10)
+if(NOT res STREQUAL 1)
+	message(FATAL_ERROR "exit status ${res}, expected 1: ${err}")
+endif()
+check_match("${err}" "record 1: input error")
+check_match("${out}" "^\n$")
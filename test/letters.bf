@@ -0,0 +1,11 @@
+[ Print the alphabet 20 times; the input byte keeps it from being run at compile time ]
+
+,[-]
+++++ ++++ ++++ ++++ ++++          Cell 0: lines (20)
+[
+	>[-]+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++     Cell 1: letter ('A')
+	>[-]++++++++++++++++++++++++++     Cell 2: letters left (26)
+	[<.+>-]
+	>[-]++++ ++++ ++.                Cell 3: newline
+	<<<-
+]
@@ -0,0 +1,6 @@
+[ Print a string stored in cells ]
+
+,[-]
+>++++ ++++ [<++++ ++++ +>-]<     Cell 0: 'H'
+>>+++++ +++++ [<+++++ +++++ >-]<+++++    Cell 1: 'i'
+<[<]>[.>]
@@ -0,0 +1,12 @@
+# Record a loop profile, optimize with it, and use it for another script.
+include("${TEST_DIR}/steps.cmake")
+file(WRITE input "x")
+file(REMOVE profile)
+
+run_step(plain 0 "${TEST_DIR}/letters.bf")
+run_step(recorded 0 -g profile "${TEST_DIR}/letters.bf")
+check_same(plain.out recorded.out)
+run_step(optimized 0 -u profile "${TEST_DIR}/letters.bf")
+check_same(plain.out optimized.out)
+run_step(other 1 -u profile "${TEST_DIR}/outz.bf")
+check_match("${step_error}" "profile is of another script")
@@ -0,0 +1,6 @@
+[ Print each byte of an input line plus one, up to the newline ]
+
+,----------[
+	+++++++++++.
+	,----------
+]
@@ -0,0 +1,6 @@
+# Run hgbf with the options ARGS (separated by `|') and INPUT as stdin, and
+# print its output and error messages for the test to match.
+string(REPLACE "|" ";" args "${ARGS}")
+execute_process(COMMAND "${HGBF}" ${args}
+	INPUT_FILE "${INPUT}" OUTPUT_VARIABLE out ERROR_VARIABLE err)
+message("${out}${err}")
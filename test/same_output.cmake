@@ -0,0 +1,15 @@
+# Run hgbf on SCRIPT with INPUT, once with the options ARGS_A and once with
+# ARGS_B (separated by `|'), and fail unless the output and exit status are the
+# same.
+string(REPLACE "|" ";" args_a "${ARGS_A}")
+string(REPLACE "|" ";" args_b "${ARGS_B}")
+execute_process(COMMAND "${HGBF}" ${args_a} "${SCRIPT}"
+	INPUT_FILE "${INPUT}" OUTPUT_VARIABLE out_a RESULT_VARIABLE res_a)
+execute_process(COMMAND "${HGBF}" ${args_b} "${SCRIPT}"
+	INPUT_FILE "${INPUT}" OUTPUT_VARIABLE out_b RESULT_VARIABLE res_b)
+if(NOT res_a STREQUAL res_b)
+	message(FATAL_ERROR "exit status ${res_a} with `${ARGS_A}', ${res_b} with `${ARGS_B}'")
+endif()
+if(NOT out_a STREQUAL out_b)
+	message(FATAL_ERROR "output differs between `${ARGS_A}' and `${ARGS_B}'")
+endif()
@@ -0,0 +1,3 @@
+[ Add two input bytes in a linear loop ]
+
+,>,<[->+<]>.
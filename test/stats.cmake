@@ -0,0 +1,13 @@
+# Write statistics of runs as JSON.
+include("${TEST_DIR}/steps.cmake")
+file(WRITE input "x")
+
+run_step(plain 0 -j stats.json "${TEST_DIR}/letters.bf")
+file(READ stats.json stats)
+check_match("${stats}" "\"instructions\":null,.*\"output_bytes\":540,.*\"error\":null")
+run_step(counted 0 -p -j stats.json "${TEST_DIR}/letters.bf")
+file(READ stats.json stats)
+check_match("${stats}" "\"instructions\":[0-9]+,")
+run_step(limited 1 -S 100 -j stats.json "${TEST_DIR}/letters.bf")
+file(READ stats.json stats)
+check_match("${stats}" "\"error\":{\"kind\":\"runtime\",\"message\":\"step limit exceeded")
@@ -0,0 +1,29 @@
+# Helpers for the tests that run hgbf in several steps.
+
+# Run hgbf with the arguments, writing its output to `${name}.out`. Fail unless
+# it exits with the status `expect`, 0 or 1.
+function(run_step name expect)
+	execute_process(COMMAND "${HGBF}" ${ARGN}
+		INPUT_FILE input OUTPUT_FILE "${name}.out" ERROR_VARIABLE err
+		RESULT_VARIABLE res)
+	if(NOT res STREQUAL expect)
+		message(FATAL_ERROR "${name}: exit status ${res}, expected ${expect}: ${err}")
+	endif()
+	set(step_error "${err}" PARENT_SCOPE)
+endfunction()
+
+# Fail unless the files have the same content.
+function(check_same file_a file_b)
+	file(READ "${file_a}" a)
+	file(READ "${file_b}" b)
+	if(NOT a STREQUAL b)
+		message(FATAL_ERROR "${file_a} and ${file_b} differ")
+	endif()
+endfunction()
+
+# Fail unless the message matches the regular expression.
+function(check_match text regex)
+	if(NOT text MATCHES "${regex}")
+		message(FATAL_ERROR "`${text}' does not match `${regex}'")
+	endif()
+endfunction()
@@ -0,0 +1,22 @@
+# Carry cells from run to run in a tape, which a failed run leaves unchanged.
+include("${TEST_DIR}/steps.cmake")
+file(WRITE input "")
+file(REMOVE tape)
+
+run_step(stored 0 -w tape -e "++++++++[>++++++++<-]>+")
+run_step(loaded 0 -t tape -w tape -e ".+.")
+file(READ loaded.out out)
+check_match("${out}" "^AB$")
+file(SHA256 tape before)
+run_step(failed 1 -t tape -w tape -S 5 "${TEST_DIR}/forever.bf")
+check_match("${step_error}" "step limit exceeded")
+file(SHA256 tape after)
+if(NOT before STREQUAL after)
+	message(FATAL_ERROR "a failed run changed the tape")
+endif()
+run_step(reloaded 0 -t tape -e ".")
+file(READ reloaded.out out)
+check_match("${out}" "^B$")
+
+run_step(missing 1 -t no-tape -e ".")
+check_match("${step_error}" "cannot open tape")